@@ -0,0 +1,504 @@
+#pragma once
+#include <bitset>
+#include <memory>
+#include <cstring>
+#include <unordered_map>
+#include "HBV.h"
+#include "Entity.h"
+#include "MPL.h"
+#include "Trace.h"
+#include "Memory.h"
+
+namespace ESL
+{
+	//archetype world, an alternative layout to States
+	//entities with the same component set share fixed size chunks of columns
+	//components are trivially copyable and moved between archetypes by memcpy
+	constexpr index_t MaxArchetypeComponents = 64u;
+	using Signature = std::bitset<MaxArchetypeComponents>;
+
+	inline index_t NextComponentId() noexcept
+	{
+		static index_t counter = 0u;
+		return counter++;
+	}
+
+	//process wide id of a component type
+	template<typename T>
+	index_t ComponentId() noexcept
+	{
+		static const index_t id = NextComponentId();
+		return id;
+	}
+
+	struct ComponentInfo
+	{
+		std::size_t size;
+		std::size_t align;
+	};
+
+	class Archetype
+	{
+	public:
+		static constexpr std::size_t ChunkBytes = 16u << 10;
+		static constexpr std::size_t ChunkAlign = 64u;
+		static constexpr index_t NoColumn = ~index_t(0);
+
+	private:
+		std::pmr::memory_resource* _resource;
+		Signature _signature;
+		//column of each component id, NoColumn if absent
+		std::array<index_t, MaxArchetypeComponents> _column;
+		std::vector<index_t> _components;
+		std::vector<std::size_t> _sizes;
+		std::vector<std::size_t> _aligns;
+		std::vector<std::size_t> _offsets;
+		index_t _capacity;
+		index_t _size = 0u;
+		std::pmr::vector<char*> _chunks;
+		//cached neighbours, the archetype reached by adding/removing a component
+		std::array<Archetype*, MaxArchetypeComponents> _add{};
+		std::array<Archetype*, MaxArchetypeComponents> _remove{};
+
+		friend class ArchetypeWorld;
+
+		//entity ids first, then one column per component
+		bool Layout(index_t capacity) noexcept
+		{
+			std::size_t offset = sizeof(Entity) * capacity;
+			for (index_t i = 0; i < _components.size(); ++i)
+			{
+				offset = VirtualMemory::AlignUp(offset, _aligns[i]);
+				_offsets[i] = offset;
+				offset += _sizes[i] * capacity;
+			}
+			return offset <= ChunkBytes;
+		}
+
+	public:
+		Archetype(const Signature& signature, const std::vector<ComponentInfo>& infos, std::pmr::memory_resource* resource)
+			: _resource(resource), _signature(signature), _chunks(resource)
+		{
+			_column.fill(NoColumn);
+			std::size_t rowBytes = sizeof(Entity);
+			for (index_t id = 0; id < MaxArchetypeComponents; ++id)
+				if (signature[id])
+				{
+					_column[id] = (index_t)_components.size();
+					_components.push_back(id);
+					_sizes.push_back(infos[id].size);
+					_aligns.push_back(infos[id].align);
+					rowBytes += infos[id].size;
+				}
+			_offsets.resize(_components.size());
+			//shrink until the padding fits too
+			_capacity = (index_t)(ChunkBytes / rowBytes);
+			while (!Layout(_capacity))
+				--_capacity;
+			assert(_capacity > 0);
+		}
+
+		Archetype(const Archetype&) = delete;
+
+		~Archetype()
+		{
+			for (auto chunk : _chunks)
+				_resource->deallocate(chunk, ChunkBytes, ChunkAlign);
+		}
+
+		const Signature& Components() const noexcept
+		{
+			return _signature;
+		}
+
+		bool Has(index_t id) const noexcept
+		{
+			return _column[id] != NoColumn;
+		}
+
+		index_t Size() const noexcept
+		{
+			return _size;
+		}
+
+		index_t ChunkCount() const noexcept
+		{
+			return (_size + _capacity - 1) / _capacity;
+		}
+
+		index_t ChunkSize(index_t chunk) const noexcept
+		{
+			return (std::min)(_capacity, _size - chunk * _capacity);
+		}
+
+		Entity* Entities(index_t chunk) noexcept
+		{
+			return (Entity*)_chunks[chunk];
+		}
+
+		template<typename T>
+		T* Column(index_t chunk) noexcept
+		{
+			return (T*)(_chunks[chunk] + _offsets[_column[ComponentId<T>()]]);
+		}
+
+		void* At(index_t id, index_t row) noexcept
+		{
+			index_t column = _column[id];
+			return _chunks[row / _capacity] + _offsets[column] + _sizes[column] * (row % _capacity);
+		}
+
+		Entity& EntityAt(index_t row) noexcept
+		{
+			return Entities(row / _capacity)[row % _capacity];
+		}
+
+		//append n rows for e, e+1..., columns are left for the caller
+		index_t Push(Entity e, index_t n = 1u)
+		{
+			index_t row = _size;
+			_size += n;
+			while (_chunks.size() * _capacity < _size)
+				_chunks.push_back((char*)_resource->allocate(ChunkBytes, ChunkAlign));
+			for (index_t i = 0; i < n; ++i)
+				EntityAt(row + i) = Entity{ e.id + i, e.generation };
+			return row;
+		}
+
+		//swap the last row into row, return the entity now living at row
+		Entity Erase(index_t row) noexcept
+		{
+			index_t last = --_size;
+			Entity moved = EntityAt(last);
+			if (row != last)
+			{
+				EntityAt(row) = moved;
+				for (index_t i = 0; i < _components.size(); ++i)
+					memcpy(At(_components[i], row), At(_components[i], last), _sizes[i]);
+			}
+			if (_size <= (_chunks.size() - 1) * _capacity)
+			{
+				_resource->deallocate(_chunks.back(), ChunkBytes, ChunkAlign);
+				_chunks.pop_back();
+			}
+			return moved;
+		}
+
+		//copy the shared columns of a row into another archetype
+		void CopyTo(index_t row, Archetype& other, index_t otherRow) noexcept
+		{
+			for (index_t i = 0; i < _components.size(); ++i)
+			{
+				index_t id = _components[i];
+				if (other.Has(id))
+					memcpy(other.At(id, otherRow), At(id, row), _sizes[i]);
+			}
+		}
+	};
+
+	namespace Dispatcher
+	{
+		template<typename... Ts>
+		struct ChunkDispatchHelper
+		{
+			template<typename T>
+			__forceinline static auto Column(Archetype& archetype, index_t chunk)
+			{
+				if constexpr(std::is_same_v<T, Entity>)
+					return archetype.Entities(chunk);
+				else if constexpr(is_filter<T>::value || std::is_empty_v<T>)
+					return (T*)nullptr;
+				else
+					return archetype.Column<T>(chunk);
+			}
+
+			template<typename T>
+			__forceinline static decltype(auto) Take(T* column, index_t i)
+			{
+				if constexpr(is_filter<T>::value || std::is_empty_v<T>)
+					return T{};
+				else
+					return (column[i]);
+			}
+
+			template<typename F, std::size_t... Is>
+			__forceinline static void DispatchChunk(Archetype& archetype, index_t chunk, F& f, std::index_sequence<Is...>)
+			{
+				auto columns = std::make_tuple(Column<Ts>(archetype, chunk)...);
+				index_t count = archetype.ChunkSize(chunk);
+				for (index_t i = 0; i < count; ++i)
+					f(Take<Ts>(std::get<Is>(columns), i)...);
+			}
+
+			template<typename F>
+			static void Dispatch(Archetype& archetype, F& f)
+			{
+				for (index_t chunk = 0; chunk < archetype.ChunkCount(); ++chunk)
+					DispatchChunk(archetype, chunk, f, std::index_sequence_for<Ts...>{});
+			}
+		};
+	}
+
+	class ArchetypeWorld
+	{
+		struct Location
+		{
+			Archetype* archetype;
+			index_t row;
+		};
+
+		std::pmr::memory_resource* _resource;
+		std::vector<ComponentInfo> _infos;
+		//membership index, one bit_vector per component
+		std::vector<HBV::bit_vector> _has;
+		std::unordered_map<Signature, std::unique_ptr<Archetype>> _archetypes;
+		std::vector<Archetype*> _archetypeList;
+		std::vector<Location> _locations;
+		std::vector<Generation> _generations;
+		std::vector<index_t> _free;
+
+		template<typename T>
+		index_t Register()
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "archetype components are moved by memcpy");
+			index_t id = ComponentId<T>();
+			assert(id < MaxArchetypeComponents);
+			if (_infos.size() <= id)
+				_infos.resize(id + 1, ComponentInfo{ 0u, 1u });
+			_infos[id] = std::is_empty_v<T> ? ComponentInfo{ 0u, 1u } : ComponentInfo{ sizeof(T), alignof(T) };
+			while (_has.size() <= id)
+				_has.emplace_back(10u, false, _resource);
+			return id;
+		}
+
+		Archetype& GetArchetype(const Signature& signature)
+		{
+			auto it = _archetypes.find(signature);
+			if (it != _archetypes.end())
+				return *it->second;
+			auto archetype = std::make_unique<Archetype>(signature, _infos, _resource);
+			Archetype* result = archetype.get();
+			_archetypes.emplace(signature, std::move(archetype));
+			_archetypeList.push_back(result);
+			return *result;
+		}
+
+		Archetype& Neighbour(Archetype& from, index_t id, bool add)
+		{
+			auto& cache = add ? from._add : from._remove;
+			if (cache[id] == nullptr)
+			{
+				Signature signature = from.Components();
+				signature.set(id, add);
+				cache[id] = &GetArchetype(signature);
+			}
+			return *cache[id];
+		}
+
+		void GrowTo(index_t to)
+		{
+			if (_locations.size() >= to)
+				return;
+			_locations.resize(to, Location{ nullptr, 0u });
+			_generations.resize(to, 0u);
+		}
+
+		void SetHas(index_t id, index_t begin, index_t end, bool value)
+		{
+			auto& has = _has[id];
+			if (has.size() <= end)
+				has.grow_to(end + 64 * 64);
+			has.set_range(begin, end, value);
+		}
+
+		void Move(Entity e, Archetype& to)
+		{
+			Location& location = _locations[e.id];
+			Archetype& from = *location.archetype;
+			index_t row = to.Push(e);
+			from.CopyTo(location.row, to, row);
+			Entity moved = from.Erase(location.row);
+			if (moved.id != e.id)
+				_locations[moved.id].row = location.row;
+			location = Location{ &to, row };
+		}
+
+		template<typename T>
+		void Write(Archetype& archetype, index_t row, const T& value)
+		{
+			if constexpr(!std::is_empty_v<T>)
+				memcpy(archetype.At(ComponentId<T>(), row), &value, sizeof(T));
+		}
+
+	public:
+		ArchetypeWorld(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _resource(resource)
+		{
+			_has.reserve(MaxArchetypeComponents);
+		}
+
+		ArchetypeWorld(const ArchetypeWorld&) = delete;
+
+		template<typename... Ts>
+		Entity Spawn(const Ts&... args)
+		{
+			Signature signature;
+			(signature.set(Register<Ts>()), ...);
+			index_t id;
+			if (_free.empty())
+			{
+				id = (index_t)_locations.size();
+				GrowTo(id + 1);
+			}
+			else
+			{
+				id = _free.back();
+				_free.pop_back();
+			}
+			Entity e{ id, ++_generations[id] };
+			Archetype& archetype = GetArchetype(signature);
+			index_t row = archetype.Push(e);
+			(Write(archetype, row, args), ...);
+			(SetHas(ComponentId<Ts>(), id, id + 1, true), ...);
+			_locations[id] = Location{ &archetype, row };
+			return e;
+		}
+
+		//spawn n entities with fresh contiguous ids
+		template<typename... Ts>
+		std::pair<index_t, index_t> BatchSpawn(index_t n, const Ts&... args)
+		{
+			Signature signature;
+			(signature.set(Register<Ts>()), ...);
+			index_t begin = (index_t)_locations.size();
+			index_t end = begin + n;
+			GrowTo(end);
+			Archetype& archetype = GetArchetype(signature);
+			index_t row = archetype.Push(Entity{ begin, 1u }, n);
+			for (index_t i = 0; i < n; ++i)
+			{
+				(Write(archetype, row + i, args), ...);
+				_generations[begin + i] = 1u;
+				_locations[begin + i] = Location{ &archetype, row + i };
+			}
+			(SetHas(ComponentId<Ts>(), begin, end, true), ...);
+			return { begin, end };
+		}
+
+		bool Alive(Entity e) const noexcept
+		{
+			return e.id < _locations.size() && _generations[e.id] == e.generation
+				&& _locations[e.id].archetype != nullptr;
+		}
+
+		void Kill(Entity e)
+		{
+			assert(Alive(e));
+			Location& location = _locations[e.id];
+			const Signature& signature = location.archetype->Components();
+			for (index_t id = 0; id < _has.size(); ++id)
+				if (signature[id])
+					_has[id].set(e.id, false);
+			Entity moved = location.archetype->Erase(location.row);
+			if (moved.id != e.id)
+				_locations[moved.id].row = location.row;
+			location = Location{ nullptr, 0u };
+			_free.push_back(e.id);
+		}
+
+		template<typename T>
+		bool Has(Entity e) const noexcept
+		{
+			index_t id = ComponentId<T>();
+			return id < _has.size() && _has[id].contain(e.id);
+		}
+
+		template<typename T>
+		T& Get(Entity e) noexcept
+		{
+			static_assert(!std::is_empty_v<T>, "tags have no value");
+			assert(Has<T>(e));
+			Location& location = _locations[e.id];
+			return *(T*)location.archetype->At(ComponentId<T>(), location.row);
+		}
+
+		template<typename T>
+		void Add(Entity e, const T& value)
+		{
+			index_t id = Register<T>();
+			Location& location = _locations[e.id];
+			if (!location.archetype->Has(id))
+			{
+				Move(e, Neighbour(*location.archetype, id, true));
+				SetHas(id, e.id, e.id + 1, true);
+			}
+			Write(*location.archetype, location.row, value);
+		}
+
+		template<typename T>
+		void Remove(Entity e)
+		{
+			index_t id = ComponentId<T>();
+			Location& location = _locations[e.id];
+			if (id < _has.size() && location.archetype->Has(id))
+			{
+				Move(e, Neighbour(*location.archetype, id, false));
+				_has[id].set(e.id, false);
+			}
+		}
+
+		//entities having T, composable with the HBV operations
+		template<typename T>
+		const HBV::bit_vector& Available() noexcept
+		{
+			return _has[Register<T>()];
+		}
+
+		index_t ArchetypeCount() const noexcept
+		{
+			return (index_t)_archetypeList.size();
+		}
+
+		//run logic over every archetype matching the arguments, chunk by chunk
+		//arguments are components, Entity, FHas and FHasNot filters
+		template<typename F>
+		void Dispatch(F&& logic)
+		{
+			using Trait = MPL::generic_function_trait<std::decay_t<F>>;
+			using DecayArgument = MPL::map_t<std::decay_t, typename Trait::argument_type>;
+			Signature include, exclude;
+			Match(include, exclude, DecayArgument{});
+			for (auto archetype : _archetypeList)
+			{
+				const Signature& components = archetype->Components();
+				if ((components & include) != include || (components & exclude).any() || archetype->Size() == 0)
+					continue;
+				MPL::rewrap_t<Dispatcher::ChunkDispatchHelper, DecayArgument>::Dispatch(*archetype, logic);
+			}
+		}
+
+	private:
+		template<typename T>
+		void MatchOne(Signature& include, Signature& exclude)
+		{
+			if constexpr(std::is_same_v<T, Entity>)
+				return;
+			else if constexpr(is_filter<T>::value)
+			{
+				static_assert(T::type == Trace::Has || T::type == Trace::HasNot, "archetype worlds have no tracers");
+				if constexpr(T::type == Trace::Has)
+					include.set(Register<typename T::target>());
+				else
+					exclude.set(Register<typename T::target>());
+			}
+			else
+				include.set(Register<T>());
+		}
+
+		template<typename... Ts>
+		void Match(Signature& include, Signature& exclude, MPL::typelist<Ts...>)
+		{
+			(MatchOne<Ts>(include, exclude), ...);
+		}
+	};
+}
@@ -2,7 +2,14 @@
 #include <iostream>
 #include "TbbGraph.h"
 #include "Flatten.h"
+#include "Archetype.h"
+#include "History.h"
 #include <thread>
+#include <unordered_map>
+#include <any>
+#include <random>
+#include <numeric>
+#include <cstdio>
 
 
 class TimerBlock {
@@ -53,7 +60,7 @@ struct location { float x, y; };
 //locationΪ,VecΪ
 ENTITY_STATE(location, Vec);
 //meshΪ,UniqueVecΪ
-struct mesh {/*some data*/ };
+struct mesh { int id;/*some data*/ };
 ENTITY_STATE(mesh, UniqueVec);
 
 constexpr std::size_t Count = 400'000u;
@@ -69,8 +76,8 @@ void GameShowCase()
 		states.CreateState<location>();
 		states.CreateState<mesh>();
 		//1kw,ֱʹģ
-		states.BatchSpawnEntity(Count / 2, location{ 0,0 }, *(new mesh{})); //Mesh1
-		states.BatchSpawnEntity(Count / 2, location{ 0,0 }, *(new mesh{})); //Mesh2
+		states.BatchSpawnEntity(Count / 2, location{ 0,0 }, mesh{ 1 }); //Mesh1
+		states.BatchSpawnEntity(Count / 2, location{ 0,0 }, mesh{ 2 }); //Mesh2
 	}
 	{
 		ESL::LogicGraph graph(states);
@@ -85,6 +92,7 @@ void GameShowCase()
 			buffer.reserve(Count / 2);
 			for (auto i = 0; i < size; ++i)
 			{
+				if (!meshs.HasUnique(i)) continue;
 				//UniqueVecӿ
 				//һģ,Ϊ,Ϊƥ׼
 				const mesh& toDraw = meshs.GetUniqueAsFilter(i);
@@ -158,6 +166,356 @@ void BenchMark_NESL()
 }
 
 
+//tag component, only a bit per entity
+struct frozen {};
+ENTITY_TAG(frozen, ESL::HasNot);
+
+void BenchMark_Tag()
+{
+	ESL::States states;
+	states.CreateState<location>();
+	states.CreateState<frozen>();
+	{
+		TimerBlock timer("create 10m entity with tag");
+		states.BatchSpawnEntity(Count / 2, location{ 0,0 }, frozen{});
+		states.BatchSpawnEntity(Count / 2, location{ 0,0 });
+	}
+	{
+		TimerBlock timer("update 10m entity without tag");
+		ESL::Dispatch(states, [](location& loc, FHasNot(frozen))
+		{
+			loc.x += 1.f;
+		});
+	}
+}
+
+//questions about a world that don't need every entity
+void BenchMark_Query()
+{
+	ESL::States states;
+	states.CreateState<location>();
+	states.CreateState<frozen>();
+	states.BatchSpawnEntity(Count / 2, location{ 0,0 });
+	states.BatchSpawnEntity(Count / 2, location{ 1,0 }, frozen{});
+	std::size_t n = 0u;
+	{
+		TimerBlock timer("count frozen by dispatch");
+		ESL::Dispatch(states, [&n](const location&, FHas(frozen)) { ++n; });
+	}
+	{
+		TimerBlock timer("count frozen by popcount");
+		n = ESL::Count(states, [](const location&, FHas(frozen)) {});
+	}
+	bool any;
+	{
+		TimerBlock timer("any frozen moved");
+		any = ESL::Any(states, [](const location& loc, FHas(frozen)) { return loc.x > 0.f; });
+	}
+	std::cout << n << " frozen, moved " << any << "\n";
+}
+
+//same components in both layouts, narrow query touches 2, wide query touches 5
+struct body_position { float x, y, z; };
+ENTITY_STATE(body_position, Vec);
+struct body_velocity { float x, y, z; };
+ENTITY_STATE(body_velocity, Vec);
+struct body_force { float x, y, z; };
+ENTITY_STATE(body_force, Vec);
+struct body_mass { float inverse; };
+ENTITY_STATE(body_mass, Vec);
+struct body_damping { float factor; };
+ENTITY_STATE(body_damping, Vec);
+
+void NarrowQuery(body_position& p, const body_velocity& v)
+{
+	p.x += v.x; p.y += v.y; p.z += v.z;
+}
+
+void WideQuery(body_position& p, body_velocity& v, const body_force& f, const body_mass& m, const body_damping& d)
+{
+	v.x = (v.x + f.x * m.inverse) * d.factor;
+	v.y = (v.y + f.y * m.inverse) * d.factor;
+	v.z = (v.z + f.z * m.inverse) * d.factor;
+	p.x += v.x; p.y += v.y; p.z += v.z;
+}
+
+void BenchMark_Archetype()
+{
+	const body_position p{ 0,0,0 };
+	const body_velocity v{ 1,1,1 };
+	const body_force f{ 0,-1,0 };
+	const body_mass m{ 1 };
+	const body_damping d{ 0.99f };
+	{
+		std::cout << "States:\n";
+		ESL::States states;
+		states.CreateState<body_position>();
+		states.CreateState<body_velocity>();
+		states.CreateState<body_force>();
+		states.CreateState<body_mass>();
+		states.CreateState<body_damping>();
+		//half of the bodies are not simulated, so there are two component sets
+		states.BatchSpawnEntity(Count / 2, p, v, f, m, d);
+		states.BatchSpawnEntity(Count / 2, p, v);
+		{
+			TimerBlock timer("narrow query");
+			ESL::Dispatch(states, [](body_position& p, const body_velocity& v) { NarrowQuery(p, v); });
+		}
+		{
+			TimerBlock timer("wide query");
+			ESL::Dispatch(states, [](body_position& p, body_velocity& v, const body_force& f, const body_mass& m, const body_damping& d) 
+			{ 
+				WideQuery(p, v, f, m, d); 
+			});
+		}
+	}
+	{
+		std::cout << "Archetype:\n";
+		ESL::ArchetypeWorld world;
+		world.BatchSpawn(Count / 2, p, v, f, m, d);
+		world.BatchSpawn(Count / 2, p, v);
+		{
+			TimerBlock timer("narrow query");
+			world.Dispatch([](body_position& p, const body_velocity& v) { NarrowQuery(p, v); });
+		}
+		{
+			TimerBlock timer("wide query");
+			world.Dispatch([](body_position& p, body_velocity& v, const body_force& f, const body_mass& m, const body_damping& d)
+			{
+				WideQuery(p, v, f, m, d);
+			});
+		}
+	}
+}
+
+//spatial system walks entities cell by cell, storage follows id
+struct grid_position { float x, y; };
+ENTITY_STATE(grid_position, Vec);
+struct grid_payload { float data[8]; };
+ENTITY_STATE(grid_payload, Vec);
+
+uint64_t MortonCode(uint32_t x, uint32_t y)
+{
+	uint64_t code = 0u;
+	for (uint32_t i = 0; i < 32; ++i)
+		code |= (uint64_t((x >> i) & 1u) << (2 * i)) | (uint64_t((y >> i) & 1u) << (2 * i + 1));
+	return code;
+}
+
+void BenchMark_Reorder()
+{
+	ESL::States states;
+	states.CreateState<grid_position>();
+	states.CreateState<grid_payload>();
+	auto es = states.BatchSpawnEntity(Count, grid_position{ 0,0 }, grid_payload{});
+	std::mt19937 rng{ 42u };
+	ESL::Dispatch(states, [&rng](grid_position& p)
+	{
+		p.x = float(rng() % 4096u);
+		p.y = float(rng() % 4096u);
+	});
+	auto key = [](const grid_position& p) { return MortonCode(uint32_t(p.x), uint32_t(p.y)); };
+	auto walk = [&states](const std::vector<ESL::index_t>& ids)
+	{
+		auto& payloads = *states.GetState<grid_payload>();
+		float sum = 0.f;
+		for (int pass = 0; pass < 10; ++pass)
+			for (auto id : ids)
+				sum += payloads.Get(id).data[pass % 8];
+		return sum;
+	};
+	//the cell order the system visits in
+	auto visit = states.SortByKey<grid_position>(es.first, es.second, key, [](auto first, auto last)
+	{
+		std::sort(first, last);
+	});
+	{
+		TimerBlock timer("spatial walk, storage by id");
+		walk(visit);
+	}
+	{
+		TimerBlock timer("reorder by morton code");
+		ESL::ReorderParallel<grid_position>(states, es.first, es.second, key);
+	}
+	std::iota(visit.begin(), visit.end(), es.first);
+	{
+		TimerBlock timer("spatial walk, storage by cell");
+		walk(visit);
+	}
+}
+
+//level data as it comes from a file, one distinct value per entity
+constexpr std::size_t LevelCount = 1'000'000u;
+
+//the other containers that take a whole column at once
+struct import_virtual { float x, y, z; };
+ENTITY_STATE(import_virtual, VirtualVec);
+struct import_paged { float x, y, z; };
+ENTITY_STATE(import_paged, PagedVec);
+struct import_buffered { float x, y, z; };
+ENTITY_STATE(import_buffered, DoubleVec);
+
+void BenchMark_Import()
+{
+	std::vector<body_position> positions(LevelCount);
+	std::vector<body_velocity> velocities(LevelCount);
+	for (std::size_t i = 0; i < LevelCount; ++i)
+	{
+		positions[i] = { float(i), 0, 0 };
+		velocities[i] = { 0, float(i), 0 };
+	}
+	{
+		ESL::States states;
+		states.CreateState<body_position>();
+		states.CreateState<body_velocity>();
+		TimerBlock timer("import 1m entity one by one");
+		auto es = states.BatchSpawnEntity(LevelCount);
+		auto& ps = *states.GetState<body_position>();
+		auto& vs = *states.GetState<body_velocity>();
+		for (ESL::index_t i = es.first; i < es.second; ++i)
+		{
+			ps.Create(i, positions[i - es.first]);
+			vs.Create(i, velocities[i - es.first]);
+		}
+	}
+	{
+		ESL::States states;
+		states.CreateState<body_position>();
+		states.CreateState<body_velocity>();
+		TimerBlock timer("import 1m entity from spans");
+		states.BatchSpawnEntity(LevelCount, ESL::FromRange(positions), ESL::FromRange(velocities));
+	}
+	{
+		ESL::States states;
+		states.CreateState<body_position>();
+		states.CreateState<body_velocity>();
+		TimerBlock timer("import 1m entity from generators");
+		states.BatchSpawnEntity(LevelCount, 
+			ESL::Generate([](ESL::index_t i) { return body_position{ float(i), 0, 0 }; }),
+			ESL::Generate([](ESL::index_t i) { return body_velocity{ 0, float(i), 0 }; }));
+	}
+	{
+		ESL::States states;
+		states.CreateState<import_virtual>();
+		states.CreateState<import_paged>();
+		states.CreateState<import_buffered>();
+		TimerBlock timer("import 1m entity from generators, VirtualVec PagedVec DoubleVec");
+		states.BatchSpawnEntity(LevelCount,
+			ESL::Generate([](ESL::index_t i) { return import_virtual{ float(i), 0, 0 }; }),
+			ESL::Generate([](ESL::index_t i) { return import_paged{ 0, float(i), 0 }; }),
+			ESL::Generate([](ESL::index_t i) { return import_buffered{ 0, 0, float(i) }; }));
+	}
+}
+
+//the node based container Hash used to be, kept as baseline
+template<typename T>
+class StdHash
+{
+	std::pmr::unordered_map<ESL::index_t, T> _states;
+public:
+	StdHash(std::size_t sz = 10u, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+		: _states(resource)
+	{
+		_states.reserve(sz);
+	}
+	T &Get(ESL::index_t e)
+	{
+		return _states.at(e);
+	}
+	const T &Get(ESL::index_t e) const
+	{
+		return _states.at(e);
+	}
+
+	T &Create(ESL::index_t e, const T& arg)
+	{
+		return _states.insert_or_assign(e, T{ arg }).first->second;
+	}
+
+	void Remove(ESL::index_t e)
+	{
+		_states.erase(e);
+	}
+};
+
+//rare components, only 1 of RareStride entities has one
+struct health { float v; };
+ENTITY_STATE(health, Hash);
+struct armor { float v; };
+ENTITY_STATE(armor, StdHash);
+constexpr std::size_t RareStride = 100u;
+
+template<typename T>
+void BenchMark_RareComponent(const char* name)
+{
+	std::cout << name << ":\n";
+	ESL::States states;
+	auto& rare = states.CreateState<T>();
+	states.CreateState<location>();
+	states.BatchSpawnEntity(Count, location{ 0,0 });
+	{
+		TimerBlock timer("create rare component");
+		for (ESL::index_t i = 0; i < Count; i += RareStride)
+			rare.Create(i, T{ 1 });
+	}
+	std::cout << "rare component bytes: " << rare.AllocatedBytes() << "\n\n";
+	{
+		TimerBlock timer("update rare component");
+		ESL::Dispatch(states, [](T& r, const location& loc)
+		{
+			r.v += loc.x;
+		});
+	}
+	{
+		TimerBlock timer("remove rare component");
+		for (ESL::index_t i = 0; i < Count; i += RareStride * 2)
+			states.Entities().Kill(states.GetEntity(i));
+		states.Tick();
+	}
+}
+
+void BenchMark_Hash()
+{
+	BenchMark_RareComponent<health>("Hash");
+	BenchMark_RareComponent<armor>("std::unordered_map");
+}
+
+//same data, Vec grows by copying while VirtualVec only commits pages
+struct position { float x, y, z; };
+ENTITY_STATE(position, Vec);
+struct heading { float x, y, z; };
+ENTITY_STATE(heading, VirtualVec);
+constexpr std::size_t HugeCount = 10'000'000u;
+
+//run under perf stat -e dTLB-load-misses (or VTune on windows) to compare TLB misses
+template<typename T>
+void BenchMark_LargeColumn(const char* name, std::pmr::memory_resource* resource)
+{
+	std::cout << name << ":\n";
+	ESL::States states{ resource };
+	states.CreateState<T>();
+	{
+		TimerBlock timer("create 10m entity");
+		states.BatchSpawnEntity(HugeCount, T{ 0,0,0 });
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		TimerBlock timer("scan 10m entity");
+		ESL::Dispatch(states, [](T& v)
+		{
+			v.x += 1.f;
+			v.z += v.y;
+		});
+	}
+}
+
+void BenchMark_HugePage()
+{
+	BenchMark_LargeColumn<position>("Vec", std::pmr::get_default_resource());
+	ESL::VirtualResource arena{ std::size_t(1) << 32 };
+	BenchMark_LargeColumn<heading>("VirtualVec", &arena);
+}
+
 void BenchMark_LogicGraph()
 {
 	Timer timer;
@@ -183,11 +541,545 @@ void BenchMark_LogicGraph()
 	timer.finish();
 }
 
+//one writer and two readers of the same state, serialised with Vec, concurrent with DoubleVec
+struct sim_position { float x, y; };
+ENTITY_STATE(sim_position, Vec);
+struct sim_position_buffered { float x, y; };
+ENTITY_STATE(sim_position_buffered, DoubleVec);
+
+template<typename T>
+void BenchMark_ReadWriteGraph(const char* name)
+{
+	ESL::States states;
+	states.CreateState<T>();
+	states.CreateState<location>();
+	states.BatchSpawnEntity(Count, T{ 0,0 }, location{ 1,1 });
+	ESL::LogicGraph graph(states);
+	graph.Schedule<ESL::ParallelDispatcher>([](T& p, const location& v)
+	{
+		p.x += v.x;
+		p.y += v.y;
+	}, "Move");
+	std::atomic<int> visible{ 0 };
+	graph.Schedule<ESL::ParallelDispatcher>([&visible](const T& p)
+	{
+		if (p.x < 100.f && p.y < 100.f)
+			visible.fetch_add(1, std::memory_order_relaxed);
+	}, "Cull");
+	graph.Schedule<ESL::ParallelDispatcher>([](const T& p, location& l)
+	{
+		l.x = p.y * 0.001f;
+	}, "Feedback");
+	ESL::TbbGraph flowGraph;
+	graph.Build(flowGraph);
+	TimerBlock timer(name);
+	for (int i = 0; i < 10; ++i)
+	{
+		flowGraph.RunOnce();
+		states.Tick();
+	}
+}
+
+void BenchMark_DoubleBuffer()
+{
+	BenchMark_ReadWriteGraph<sim_position>("10 frames, Vec");
+	BenchMark_ReadWriteGraph<sim_position_buffered>("10 frames, DoubleVec");
+}
+
+//a system writing every entity of a state traced with Borrow
+struct traced_position { float x, y; };
+ENTITY_STATE(traced_position, Vec, ESL::Borrow);
+struct untraced_position { float x, y; };
+ENTITY_STATE(untraced_position, Vec);
+
+void BenchMark_Borrow()
+{
+	ESL::States states;
+	states.CreateState<traced_position>();
+	states.CreateState<untraced_position>();
+	states.BatchSpawnEntity(Count, traced_position{ 0,0 }, untraced_position{ 0,0 });
+	auto& positions = *states.GetState<traced_position>();
+	{
+		TimerBlock timer("10 passes, no tracer");
+		for (int i = 0; i < 10; ++i)
+			ESL::Dispatch(states, [](untraced_position& p)
+			{
+				p.x += 1.f;
+			});
+	}
+	{
+		TimerBlock timer("10 passes, Borrow marked per Get");
+		for (int i = 0; i < 10; ++i)
+		{
+			ESL::Dispatch(states, [&positions](ESL::Entity e, FHas(traced_position))
+			{
+				positions.Get(e.id).x += 1.f;
+			});
+			states.ResetTracers();
+		}
+	}
+	{
+		TimerBlock timer("10 passes, Borrow merged by Dispatch");
+		for (int i = 0; i < 10; ++i)
+		{
+			ESL::Dispatch(states, [](traced_position& p)
+			{
+				p.x += 1.f;
+			});
+			states.ResetTracers();
+		}
+	}
+}
+
+//spawn a few entities a frame, two consumers of "created" at different rates
+struct spawned_bitset { float x; };
+ENTITY_STATE(spawned_bitset, Vec, ESL::Create);
+struct spawned_versioned { float x; };
+ENTITY_STATE(spawned_versioned, Vec, ESL::Versioned);
+constexpr std::size_t SpawnPerFrame = Count / 100;
+
+void BenchMark_Versioned()
+{
+	{
+		ESL::States states;
+		states.CreateState<spawned_bitset>();
+		states.BatchSpawnEntity(Count, spawned_bitset{ 0 });
+		std::size_t everyFrame = 0u;
+		TimerBlock timer("100 frames, one Create tracer, reset every frame");
+		for (int i = 0; i < 100; ++i)
+		{
+			states.ResetTracers();
+			states.BatchSpawnEntity(SpawnPerFrame, spawned_bitset{ 0 });
+			ESL::Dispatch(states, [&everyFrame](FCreated(spawned_bitset)) { ++everyFrame; });
+		}
+	}
+	{
+		ESL::States states;
+		states.CreateState<spawned_versioned>();
+		states.BatchSpawnEntity(Count, spawned_versioned{ 0 });
+		ESL::Cursor fast, slow;
+		ESL::Dispatch(states, [](FCreated(spawned_versioned)) {}, fast);
+		ESL::Dispatch(states, [](FCreated(spawned_versioned)) {}, slow);
+		std::size_t everyFrame = 0u, everyTenFrames = 0u;
+		TimerBlock timer("100 frames, versioned, consumers every frame and every 10 frames");
+		for (int i = 0; i < 100; ++i)
+		{
+			states.BatchSpawnEntity(SpawnPerFrame, spawned_versioned{ 0 });
+			ESL::Dispatch(states, [&everyFrame](FCreated(spawned_versioned)) { ++everyFrame; }, fast);
+			if (i % 10 == 9)
+				ESL::Dispatch(states, [&everyTenFrames](FCreated(spawned_versioned)) { ++everyTenFrames; }, slow);
+		}
+		std::cout << "seen " << everyFrame << " and " << everyTenFrames << "\n";
+	}
+}
+
+//a cleanup system releasing the body handle of every entity killed this frame
+struct physics_body { std::size_t handle; };
+ENTITY_STATE(physics_body, Vec, ESL::Journal);
+
+void BenchMark_Journal()
+{
+	ESL::States states;
+	states.CreateState<physics_body>();
+	auto range = states.BatchSpawnEntity(Count, physics_body{ 1 });
+	auto& entities = states.Entities();
+	std::size_t released = 0u;
+	TimerBlock timer("100 frames, kill 1% and release their bodies");
+	for (int i = 0; i < 100; ++i)
+	{
+		for (ESL::index_t e = range.first + i; e < range.second; e += 100)
+			entities.Kill(entities.Get(e));
+		states.Tick();
+		ESL::DispatchRemoved(states, [&released](const physics_body& body)
+		{
+			released += body.handle;
+		});
+		states.ResetTracers();
+	}
+	std::cout << "released " << released << "\n";
+	std::size_t alive = 0u;
+	ESL::Dispatch(states, [&alive](const physics_body& body)
+	{
+		alive += body.handle;
+	});
+	std::cout << "alive " << alive << "\n";
+}
+
+//the same move system over compiled states and over components registered at runtime
+struct dynamic_position { float x, y, z; };
+ENTITY_STATE(dynamic_position, Vec);
+
+void BenchMark_Dynamic()
+{
+	ESL::States states;
+	states.CreateState<dynamic_position>();
+	states.CreateState<body_velocity>();
+	auto& positions = states.CreateDynamicState(ESL::DescribeComponent<dynamic_position>("position"));
+	auto& velocities = states.CreateDynamicState(ESL::DescribeComponent<body_velocity>("velocity"));
+	auto range = states.BatchSpawnEntity(Count, dynamic_position{ 0,0,0 }, body_velocity{ 1,1,1 });
+	for (ESL::index_t e = range.first; e < range.second; ++e)
+	{
+		positions.Create(e);
+		velocities.Create(e, &std::as_const(*states.GetState<body_velocity>()).Get(e));
+	}
+	{
+		TimerBlock timer("10 passes, Dispatch");
+		for (int i = 0; i < 10; ++i)
+			ESL::Dispatch(states, [](dynamic_position& p, const body_velocity& v)
+			{
+				p.x += v.x; p.y += v.y; p.z += v.z;
+			});
+	}
+	{
+		TimerBlock timer("10 passes, DispatchDynamic");
+		for (int i = 0; i < 10; ++i)
+			ESL::DispatchDynamic({ &positions, &velocities }, [](ESL::index_t, void* const* values)
+			{
+				auto& p = *static_cast<float*>(values[0]);
+				auto& v = *static_cast<const float*>(values[1]);
+				(&p)[0] += (&v)[0]; (&p)[1] += (&v)[1]; (&p)[2] += (&v)[2];
+			});
+	}
+}
+
+//end of frame with many component types, every state drops the killed entities
+template<int N>
+struct tick_column { float v; };
+ENTITY_STATE(tick_column<0>, Vec);
+ENTITY_STATE(tick_column<1>, Vec);
+ENTITY_STATE(tick_column<2>, Vec);
+ENTITY_STATE(tick_column<3>, Vec);
+ENTITY_STATE(tick_column<4>, Hash);
+ENTITY_STATE(tick_column<5>, Hash);
+ENTITY_STATE(tick_column<6>, Vec, ESL::Remove);
+ENTITY_STATE(tick_column<7>, Vec, ESL::Remove);
+
+template<typename Tick>
+void BenchMark_Tick(const char* name, Tick&& tick)
+{
+	ESL::States states;
+	states.CreateState<tick_column<0>>();
+	states.CreateState<tick_column<1>>();
+	states.CreateState<tick_column<2>>();
+	states.CreateState<tick_column<3>>();
+	states.CreateState<tick_column<4>>();
+	states.CreateState<tick_column<5>>();
+	states.CreateState<tick_column<6>>();
+	states.CreateState<tick_column<7>>();
+	auto range = states.BatchSpawnEntity(Count, tick_column<0>{}, tick_column<1>{}, tick_column<2>{}, tick_column<3>{},
+		tick_column<4>{}, tick_column<5>{}, tick_column<6>{}, tick_column<7>{});
+	auto& entities = states.Entities();
+	for (ESL::index_t e = range.first; e < range.second; e += 10)
+		entities.Kill(entities.Get(e));
+	{
+		TimerBlock timer(name);
+		tick(states);
+	}
+	using ms = std::chrono::duration<double, std::milli>;
+	auto& timings = states.LastTick();
+	std::cout << "remove " << ms(timings.remove).count() << "ms, kill " << ms(timings.kill).count() 
+		<< "ms, swap " << ms(timings.swap).count() << "ms\n";
+}
+
+//systems fetch their states every run, compare with the typeid keyed std::any map States used to have
+void BenchMark_StateLookup()
+{
+	ESL::States states;
+	states.CreateState<traced_position>();
+	states.CreateState<untraced_position>();
+	states.CreateState<physics_body>();
+	std::unordered_map<std::size_t, std::any> map;
+	map.emplace(typeid(ESL::State<traced_position>).hash_code(), std::make_any<ESL::State<traced_position>*>(states.GetState<traced_position>()));
+	map.emplace(typeid(ESL::State<physics_body>).hash_code(), std::make_any<ESL::State<physics_body>*>(states.GetState<physics_body>()));
+	std::size_t found = 0u;
+	{
+		TimerBlock timer("10m lookups, typeid hash and any_cast");
+		for (std::size_t i = 0; i < HugeCount; ++i)
+		{
+			auto it = map.find(typeid(ESL::State<physics_body>).hash_code());
+			found += std::any_cast<ESL::State<physics_body>*>(it->second) != nullptr;
+		}
+	}
+	{
+		TimerBlock timer("10m lookups, dense state id");
+		for (std::size_t i = 0; i < HugeCount; ++i)
+			found += states.GetState<physics_body>() != nullptr;
+	}
+	std::cout << "found " << found << "\n";
+}
+
+//a tracer flagging a few scattered entities a frame, then reset
+void BenchMark_TracerReset()
+{
+	constexpr HBV::index_t size = 16'000'000u;
+	auto frames = [](const char* name, auto&& reset)
+	{
+		HBV::bit_vector flag(size);
+		TimerBlock timer(name);
+		for (HBV::index_t i = 0; i < 1000; ++i)
+		{
+			for (HBV::index_t e = i; e < size; e += size / 64)
+				flag.set(e, true);
+			reset(flag);
+		}
+	};
+	frames("1000 frames, clear", [](HBV::bit_vector& flag) { flag.clear(); });
+	frames("1000 frames, expire", [](HBV::bit_vector& flag) { flag.expire(); });
+}
+
+//a whole world of 10m entities to disk and back into a fresh world
+void BenchMark_Snapshot()
+{
+	const char* path = "NESL_snapshot.bin";
+	{
+		ESL::States states;
+		states.CreateState<position>();
+		states.CreateState<heading>();
+		states.BatchSpawnEntity(HugeCount, position{ 1,2,3 }, heading{ 0,0,1 });
+		TimerBlock timer("save 10m entity");
+		states.Save(path);
+	}
+	ESL::States states;
+	states.CreateState<position>();
+	states.CreateState<heading>();
+	{
+		TimerBlock timer("load 10m entity");
+		states.Load(path);
+	}
+	std::size_t n = 0u;
+	ESL::Dispatch(states, [&n](const position&, const heading&) { ++n; });
+	std::cout << "loaded " << n << "\n";
+	std::remove(path);
+}
+
+//a branch of a 10m entity world for a what-if run that touches 1% of the entities
+struct branch_position { float x, y, z; };
+ENTITY_STATE(branch_position, PagedVec);
+
+template<typename T>
+void BenchMark_Fork(const char* name)
+{
+	std::cout << name << ":\n";
+	ESL::States states;
+	states.CreateState<T>();
+	states.BatchSpawnEntity(HugeCount, T{ 0,0,0 });
+	std::unique_ptr<ESL::States> fork;
+	{
+		TimerBlock timer("fork 10m entity");
+		fork = states.Fork();
+	}
+	{
+		TimerBlock timer("write 1% in the fork, one region");
+		auto& state = *fork->GetState<T>();
+		for (ESL::index_t e = 0; e < HugeCount / 100; ++e)
+			state.Get(e).x += 1.f;
+	}
+	{
+		//shared pages are copied before the workers write them
+		TimerBlock timer("write all in the fork, parallel");
+		ESL::DispatchParallel(*fork, [](T& p) { p.y += 1.f; });
+	}
+	{
+		TimerBlock timer("drop the fork");
+		fork.reset();
+	}
+}
+
+//sampled every frame by a profiler overlay, the report is reused
+void BenchMark_MemoryReport()
+{
+	ESL::States states;
+	states.CreateState<position>();
+	states.CreateState<heading>();
+	states.BatchSpawnEntity(HugeCount, position{ 1,2,3 }, heading{ 0,0,1 });
+	std::vector<ESL::StateMemory> report;
+	states.MemoryReport(report);
+	{
+		TimerBlock timer("100 reports of 10m entity");
+		for (int i = 0; i < 100; ++i)
+			states.MemoryReport(report);
+	}
+	for (auto& memory : report)
+		std::cout << memory.name << ": " << memory.live << " live, " << memory.allocated / (1 << 20) << "MB\n";
+}
+
+//a stats system counting entities, a plain global state must be written serially
+struct area_count { long long n; };
+GLOBAL_STATE(area_count);
+struct area_count_combinable
+{
+	long long n = 0;
+	area_count_combinable& operator+=(const area_count_combinable& other) { n += other.n; return *this; }
+};
+COMBINABLE_STATE(area_count_combinable);
+
+template<typename Dispatcher, typename T>
+void BenchMark_StatsGraph(const char* name)
+{
+	ESL::States states;
+	states.CreateState<location>();
+	states.CreateState<T>();
+	states.BatchSpawnEntity(Count, ESL::Generate([](ESL::index_t i) { return location{ float(i % 1000), 0 }; }));
+	ESL::LogicGraph graph(states);
+	graph.Schedule<Dispatcher>([](const location& l, T& count)
+	{
+		if (std::sqrt(l.x * l.x + l.y * l.y) < 500.f)
+			++count.n;
+	}, "CountInArea");
+	ESL::TbbGraph flowGraph;
+	graph.Build(flowGraph);
+	TimerBlock timer(name);
+	for (int i = 0; i < 10; ++i)
+		flowGraph.RunOnce();
+}
+
+//the same count as a reduction, the node only reads location
+template<bool Deterministic>
+void BenchMark_ReduceGraph(const char* name)
+{
+	ESL::States states;
+	states.CreateState<location>();
+	states.BatchSpawnEntity(Count, ESL::Generate([](ESL::index_t i) { return location{ float(i % 1000), 0 }; }));
+	ESL::LogicGraph graph(states);
+	long long n = 0;
+	graph.ScheduleReduce<Deterministic>(n, 0ll, [](const location& l)
+	{
+		return (long long)(std::sqrt(l.x * l.x + l.y * l.y) < 500.f);
+	}, [](long long a, long long b) { return a + b; }, "CountInArea");
+	ESL::TbbGraph flowGraph;
+	graph.Build(flowGraph);
+	TimerBlock timer(name);
+	for (int i = 0; i < 10; ++i)
+		flowGraph.RunOnce();
+}
+
+void BenchMark_Combinable()
+{
+	BenchMark_StatsGraph<ESL::DefaultDispatcher, area_count>("10 frames, GlobalState serial");
+	BenchMark_StatsGraph<ESL::ParallelDispatcher, area_count_combinable>("10 frames, CombinableState parallel");
+	BenchMark_ReduceGraph<false>("10 frames, ReduceParallel");
+	BenchMark_ReduceGraph<true>("10 frames, deterministic ReduceParallel");
+}
+
+//rollback keeps 60 frames of a component of which a few percent change every frame
+struct net_position
+{
+	float x, y;
+	bool operator==(const net_position& other) const { return x == other.x && y == other.y; }
+};
+ENTITY_STATE(net_position, Vec, ESL::CRB);
+constexpr std::size_t RollbackFrames = 60u;
+
+void BenchMark_History()
+{
+	ESL::States states;
+	states.CreateState<net_position>();
+	auto es = states.BatchSpawnEntity(Count, net_position{ 0,0 });
+	states.ResetTracers();
+	auto& positions = *states.GetState<net_position>();
+	auto simulate = [&positions, &es](std::size_t frame)
+	{
+		for (ESL::index_t e = es.first + ESL::index_t(frame % 32); e < es.second; e += 32)
+			positions.Get(e).x += 1.f;
+	};
+	{
+		std::vector<std::vector<net_position>> copies(RollbackFrames);
+		TimerBlock timer("60 frames, full copy each frame");
+		for (std::size_t f = 0; f < RollbackFrames; ++f)
+		{
+			simulate(f);
+			states.Tick();
+			auto& copy = copies[f];
+			copy.resize(es.second - es.first);
+			for (ESL::index_t e = es.first; e < es.second; ++e)
+				copy[e - es.first] = std::as_const(positions).Get(e);
+			states.ResetTracers();
+		}
+	}
+	ESL::History<net_position, RollbackFrames> history(states);
+	{
+		TimerBlock timer("60 frames, history of changes");
+		for (std::size_t f = 0; f < RollbackFrames; ++f)
+		{
+			simulate(f);
+			states.Tick();
+			history.Record();
+			states.ResetTracers();
+		}
+	}
+	{
+		TimerBlock timer("rewind 60 frames");
+		history.RewindTo(history.Oldest());
+	}
+}
+
 int main()
 {
 	
 	std::cout << "NESL:\n";
 	BenchMark_LogicGraph();
+
+	std::cout << "\nBorrow tracking:\n";
+	BenchMark_Borrow();
+
+	std::cout << "\nVersioned tracking:\n";
+	BenchMark_Versioned();
+
+	std::cout << "\nRuntime components:\n";
+	BenchMark_Dynamic();
+
+	std::cout << "\nTick:\n";
+	BenchMark_Tick("kill 10% of 8 states, serial", [](ESL::States& states) { states.Tick(); });
+	BenchMark_Tick("kill 10% of 8 states, parallel", [](ESL::States& states) { ESL::TickParallel(states); });
+
+	std::cout << "\nSnapshot:\n";
+	BenchMark_Snapshot();
+
+	std::cout << "\nFork:\n";
+	BenchMark_Fork<position>("Vec");
+	BenchMark_Fork<branch_position>("PagedVec");
+
+	std::cout << "\nMemory report:\n";
+	BenchMark_MemoryReport();
+
+	std::cout << "\nState lookup:\n";
+	BenchMark_StateLookup();
+
+	std::cout << "\nTracer reset:\n";
+	BenchMark_TracerReset();
+
+	std::cout << "\nRemoval journal:\n";
+	BenchMark_Journal();
+
+	std::cout << "\nCombinable:\n";
+	BenchMark_Combinable();
+
+	std::cout << "\nHistory:\n";
+	BenchMark_History();
+
+	std::cout << "\nDouble buffer:\n";
+	BenchMark_DoubleBuffer();
+
+	std::cout << "\nArchetype world:\n";
+	BenchMark_Archetype();
+
+	std::cout << "\nReorder:\n";
+	BenchMark_Reorder();
+
+	std::cout << "\nBulk import:\n";
+	BenchMark_Import();
+
+	std::cout << "\nTag components:\n";
+	BenchMark_Tag();
+
+	std::cout << "\nEarly exit queries:\n";
+	BenchMark_Query();
+
+	std::cout << "\nRare components:\n";
+	BenchMark_Hash();
+
+	std::cout << "\nLarge columns:\n";
+	BenchMark_HugePage();
 	/*
 	std::cout << "\nLogicGraph:\n";
 	BenchMark_LogicGraph();
@@ -1,4 +1,5 @@
 #pragma once
+#include <optional>
 #include "States.h"
 #include "MPL.h"
 
@@ -11,6 +12,12 @@ namespace ESL
 	template<typename T>
 	struct IsRawEntityState : std::conjunction<std::negation<is_filter<T>>, IsRawState<T>, IsEntityState<T>> {};
 
+	template<typename T>
+	struct IsRawTagState : IsTagState<State<T>> {};
+
+	template<typename T>
+	struct IsRawValueState : std::negation<IsRawTagState<T>> {};
+
 	namespace Dispatcher
 	{
 		template<typename... Ts>
@@ -19,10 +26,18 @@ namespace ESL
 		template<typename U,typename... Ts>
 		struct ComposeHelper<U, Ts...>
 		{
+			//with a Cursor among the states, versioned states filter by its previous run
 			template<typename S, typename F, Trace type>
 			__forceinline static decltype(auto) Take(S &states, Filter_t<F, type>)
 			{
-				return MPL::nonstrict_get<const State<F>&>(states).template Available<type>();
+				auto& state = MPL::nonstrict_get<const State<F>&>(states);
+				if constexpr(MPL::contain_v<const Cursor&, MPL::rewrap_t<MPL::typelist, S>> && IsVersioned<State<F>>{})
+				{
+					const Cursor& cursor = std::get<const Cursor&>(states);
+					return state.template Available<type>(cursor.since, cursor.last);
+				}
+				else
+					return state.template Available<type>();
 			}
 
 			template<typename S>
@@ -46,10 +61,20 @@ namespace ESL
 		template<typename... Ts>
 		struct EntityDispatchHelper
 		{
+			//mutable values are taken untraced, the dispatchers mark them through BorrowHelper
 			template<typename T, typename S>
 			__forceinline static decltype(auto) Take(S &states, index_t id, std::true_type)
 			{
-				return MPL::nonstrict_get<const State<T>&>(states).Get(id);
+				if constexpr(IsRawTagState<T>{})
+					return T{};
+				else
+				{
+					auto& state = MPL::nonstrict_get<const State<T>&>(states);
+					if constexpr(std::is_const_v<std::remove_reference_t<decltype(state)>>)
+						return state.Get(id);
+					else
+						return state.GetUntraced(id);
+				}
 			}
 
 			template<typename T, typename S>
@@ -79,10 +104,98 @@ namespace ESL
 				}
 			}
 
+			template<typename F, typename S>
+			__forceinline static decltype(auto) Dispatch(S &states, index_t id, F&& f)
+			{
+				return f(Take<Ts>(states, id, IsRawEntityState<Ts>{})...);
+			}
+		};
+
+		//Borrow of every mutable value state is marked once for the set to iterate
+		template<typename... Ts>
+		struct BorrowHelper
+		{
+			template<typename T, typename S, typename V>
+			__forceinline static void MarkState(S &states, const V& borrowed)
+			{
+				auto& state = MPL::nonstrict_get<const State<T>&>(states);
+				if constexpr(!std::is_const_v<std::remove_reference_t<decltype(state)>>)
+					state.BatchBorrow(borrowed);
+			}
+
+			template<typename T, typename S>
+			__forceinline static void MarkOne(S &states, index_t id)
+			{
+				auto& state = MPL::nonstrict_get<const State<T>&>(states);
+				if constexpr(!std::is_const_v<std::remove_reference_t<decltype(state)>>)
+					state.Borrow(id);
+			}
+
+			template<typename T, typename S, typename V>
+			__forceinline static void OwnState(S &states, const V& borrowed)
+			{
+				auto& state = MPL::nonstrict_get<const State<T>&>(states);
+				if constexpr(!std::is_const_v<std::remove_reference_t<decltype(state)>>)
+					state.OwnPages(borrowed);
+			}
+
+			//unshare forked pages before parallel workers write them
+			template<typename S, typename V>
+			__forceinline static void Own(S &states, const V& borrowed)
+			{
+				std::initializer_list<int> _{ (OwnState<Ts>(states, borrowed), 0)... };
+				(void)_;
+			}
+
+			template<typename S, typename V>
+			__forceinline static void Mark(S &states, const V& borrowed)
+			{
+				std::initializer_list<int> _{ (MarkState<Ts>(states, borrowed), 0)... };
+				(void)_;
+			}
+
+			template<typename S>
+			__forceinline static void Mark(S &states, index_t id)
+			{
+				std::initializer_list<int> _{ (MarkOne<Ts>(states, id), 0)... };
+				(void)_;
+			}
+		};
+
+		//journaled states of DispatchRemoved
+		template<typename... Ts>
+		struct RemovedHelper
+		{
+			__forceinline static auto Fetch(States &states)
+			{
+				return std::tie(std::as_const(*states.GetState<Ts>())...);
+			}
+
+			template<typename S>
+			__forceinline static decltype(auto) ComposeBitVector(S &states)
+			{
+				return HBV::compose(HBV::and_op, std::get<const State<Ts>&>(states).Removed()...);
+			}
+		};
+
+		template<typename... Ts>
+		struct RemovedDispatchHelper
+		{
+			template<typename T, typename S>
+			__forceinline static decltype(auto) Take(S &states, index_t id)
+			{
+				if constexpr(std::is_same<T, index_t>{})
+					return id;
+				else if constexpr(IsRawTagState<T>{})
+					return T{};
+				else
+					return std::get<const State<T>&>(states).GetRemoved(id);
+			}
+
 			template<typename F, typename S>
 			__forceinline static void Dispatch(S &states, index_t id, F&& f)
 			{
-				f(Take<Ts>(states, id, IsRawEntityState<Ts>{})...);
+				f(Take<Ts>(states, id)...);
 			}
 		};
 
@@ -222,10 +335,19 @@ namespace ESL
 		}
 		else
 		{
+			using Helper = MPL::rewrap_t<Dispatcher::EntityDispatchHelper, DecayArgument>;
 			const auto available{ MPL::rewrap_t<Dispatcher::ComposeHelper, Filters>::ComposeBitVector(states) };
-			HBV::for_each(available, [&states, &logic](index_t i) //
+			//marked before the logic runs, which may change what the filters compose to
+			//the marked set is a subset of the filters, so marking doesn't change it either
+			using ValueStates = MPL::filter_t<IsRawValueState, RawEntityStates>;
+			MPL::rewrap_t<Dispatcher::BorrowHelper, ValueStates>::Mark(states, available);
+			HBV::for_each_range(available, [&states, &logic](index_t i) //
+			{
+				Helper::Dispatch(states, i, logic);
+			}, [&states, &logic](index_t begin, index_t end)
 			{
-				MPL::rewrap_t<Dispatcher::EntityDispatchHelper, DecayArgument>::Dispatch(states, i, logic);
+				for (index_t i = begin; i < end; ++i)
+					Helper::Dispatch(states, i, logic);
 			});
 		}
 	}
@@ -235,9 +357,13 @@ namespace ESL
 	{
 		using Trait = MPL::generic_function_trait<std::decay_t<F>>;
 		using Argument = typename Trait::argument_type;
+		using DecayArgument = MPL::map_t<std::decay_t, Argument>;
+		using RawEntityStates = MPL::filter_t<IsRawEntityState, MPL::filter_t<IsState, DecayArgument>>;
+		using ValueStates = MPL::filter_t<IsRawValueState, RawEntityStates>;
 		if (MPL::nonstrict_get<const GlobalState<Entities>&>(states).Raw().Alive(e))
 		{
 			MPL::rewrap_t<Dispatcher::EntityDispatchHelper, DecayArgument>::Dispatch(states, e.id, logic);
+			MPL::rewrap_t<Dispatcher::BorrowHelper, ValueStates>::Mark(states, e.id);
 		}
 	}
 
@@ -247,10 +373,224 @@ namespace ESL
 		Dispatch(FetchFor(states, logic), logic);
 	}
 
+	//FCreated and FBorrowed of versioned states mean since this cursor's previous run
+	template<typename F>
+	auto Dispatch(States &states, F&& logic, Cursor& cursor)
+	{
+		cursor.Advance();
+		Dispatch(std::tuple_cat(FetchFor(states, logic), std::tie(std::as_const(cursor))), logic);
+	}
+
+	//entities having every runtime component in [first, last)
+	//logic(index_t, void* const* values) gets the value of each state in the same order
+	//the columns must not grow during the iteration
+	template<typename It, typename F>
+	void DispatchDynamic(It first, It last, F&& logic)
+	{
+		//inline up to 16 columns, more spill to the heap
+		constexpr std::size_t InlineColumns = 16u;
+		chobo::small_vector<char*, InlineColumns> columns;
+		chobo::small_vector<std::size_t, InlineColumns> strides;
+		chobo::small_vector<const HBV::bit_vector*, InlineColumns> available;
+		for (; first != last; ++first)
+		{
+			DynamicState& state = **first;
+			columns.push_back(state.Data());
+			strides.push_back(state.Stride());
+			available.push_back(&state.Available());
+		}
+		const std::size_t count = columns.size();
+		chobo::small_vector<void*, InlineColumns> values(count);
+		HBV::for_each(HBV::bit_vector_dynamic_and(available.begin(), available.end()), [&](index_t i)
+		{
+			for (std::size_t c = 0; c < count; ++c)
+				values[c] = columns[c] + std::size_t(i) * strides[c];
+			logic(i, values.data());
+		});
+	}
+
+	template<typename F>
+	void DispatchDynamic(std::initializer_list<DynamicState*> states, F&& logic)
+	{
+		DispatchDynamic(states.begin(), states.end(), logic);
+	}
+
+	//entities removed since the tracers were reset, with the values they had
+	//every state taken needs a Journal tracer, an index_t argument gets the id
+	template<typename F>
+	void DispatchRemoved(States &states, F&& logic)
+	{
+		using Trait = MPL::generic_function_trait<std::decay_t<F>>;
+		using Argument = typename Trait::argument_type;
+		using DecayArgument = MPL::map_t<std::decay_t, Argument>;
+		using RawEntityStates = MPL::filter_t<IsRawEntityState, MPL::filter_t<IsState, DecayArgument>>;
+		static_assert(MPL::size<RawEntityStates>{} > 0, "no removed state!");
+		using Helper = MPL::rewrap_t<Dispatcher::RemovedHelper, RawEntityStates>;
+
+		auto fetched = Helper::Fetch(states);
+		const auto removed{ Helper::ComposeBitVector(fetched) };
+		HBV::for_each(removed, [&fetched, &logic](index_t i)
+		{
+			MPL::rewrap_t<Dispatcher::RemovedDispatchHelper, DecayArgument>::Dispatch(fetched, i, logic);
+		});
+	}
+
 	template<typename F>
 	auto DispatchEntity(States &states, F&& logic, Entity e)
 	{
-		DispatchEntity(FetchFor(states, logic), logic, e);
+		//Entities is needed for the alive check even if the logic doesn't take it
+		auto fetched = FetchFor(states, logic);
+		if constexpr(MPL::contain_v<const GlobalState<Entities>&, MPL::rewrap_t<MPL::typelist, decltype(fetched)>>)
+			DispatchEntity(fetched, logic, e);
+		else
+			DispatchEntity(std::tuple_cat(fetched, std::tie(std::as_const(*states.GetState<ESL::Entities>()))), logic, e);
+	}
+
+	template<typename T>
+	struct IsOptional : std::false_type {};
+
+	template<typename T>
+	struct IsOptional<std::optional<T>> : std::true_type {};
+
+	namespace Dispatcher
+	{
+		//Entities is needed for ids and alive checks even if the logic doesn't take it
+		template<typename F>
+		auto FetchWithEntities(States &states, F& logic)
+		{
+			auto fetched = FetchFor(states, logic);
+			if constexpr(MPL::contain_v<const GlobalState<Entities>&, MPL::rewrap_t<MPL::typelist, decltype(fetched)>>)
+				return fetched;
+			else
+				return std::tuple_cat(fetched, std::tie(std::as_const(*states.GetState<ESL::Entities>())));
+		}
+
+		//the result the logic stopped on and the entity it stopped at
+		template<typename F, typename S>
+		auto Until(S &states, F& logic)
+		{
+			using Trait = MPL::generic_function_trait<std::decay_t<F>>;
+			using Argument = typename Trait::argument_type;
+			using Result = std::decay_t<typename Trait::return_type>;
+			using DecayArgument = MPL::map_t<std::decay_t, Argument>;
+			using RawEntityStates = MPL::filter_t<IsRawEntityState, MPL::filter_t<IsState, DecayArgument>>;
+			using ValueStates = MPL::filter_t<IsRawValueState, RawEntityStates>;
+			static_assert(std::is_same_v<Result, bool> || IsOptional<Result>{}, "logic must return bool or optional!");
+
+			using ExplictFilters = MPL::filter_t<is_filter, DecayArgument>;
+			using ImplictFilters = MPL::map_t<DefaultFilter, RawEntityStates>;
+			typename CheckFilters<ExplictFilters>::type checker; (void)checker;
+			using Filters = typename FixFilters<ExplictFilters, ImplictFilters>::type;
+
+			std::pair<Result, index_t> found{};
+			const auto available{ MPL::rewrap_t<ComposeHelper, Filters>::ComposeBitVector(states) };
+			HBV::for_each_until(available, [&states, &logic, &found](index_t i)
+			{
+				found.first = MPL::rewrap_t<EntityDispatchHelper, DecayArgument>::Dispatch(states, i, logic);
+				MPL::rewrap_t<BorrowHelper, ValueStates>::Mark(states, i);
+				found.second = i;
+				return bool(found.first);
+			});
+			return found;
+		}
+	}
+
+	//Dispatch in id order until the logic returns true or an engaged optional, which is returned
+	//mutable values are marked borrowed only for the entities visited
+	template<typename F, typename S>
+	auto DispatchUntil(S states, F&& logic)
+	{
+		return Dispatcher::Until(states, logic).first;
+	}
+
+	template<typename F>
+	auto DispatchUntil(States &states, F&& logic)
+	{
+		return DispatchUntil(FetchFor(states, logic), logic);
 	}
 
+	//whether the predicate holds for any entity it is called for, it may return bool or an optional
+	template<typename F>
+	bool Any(States &states, F&& predicate)
+	{
+		return bool(DispatchUntil(states, predicate));
+	}
+
+	//the entity of lowest id the predicate holds for
+	template<typename F>
+	std::optional<Entity> FindFirst(States &states, F&& predicate)
+	{
+		auto fetched = Dispatcher::FetchWithEntities(states, predicate);
+		auto found = Dispatcher::Until(fetched, predicate);
+		if (!found.first)
+			return std::nullopt;
+		return MPL::nonstrict_get<const GlobalState<Entities>&>(fetched).Raw().Get(found.second);
+	}
+
+	//entities the logic would be called for, it only describes the query and is never called
+	template<typename F>
+	index_t Count(States &states, F&& query)
+	{
+		using Trait = MPL::generic_function_trait<std::decay_t<F>>;
+		using Argument = typename Trait::argument_type;
+		using DecayArgument = MPL::map_t<std::decay_t, Argument>;
+		using RawEntityStates = MPL::filter_t<IsRawEntityState, MPL::filter_t<IsState, DecayArgument>>;
+
+		using ExplictFilters = MPL::filter_t<is_filter, DecayArgument>;
+		using ImplictFilters = MPL::map_t<DefaultFilter, RawEntityStates>;
+		typename Dispatcher::CheckFilters<ExplictFilters>::type checker; (void)checker;
+		using Filters = typename Dispatcher::FixFilters<ExplictFilters, ImplictFilters>::type;
+
+		auto fetched = Dispatcher::FetchWithEntities(states, query);
+		return HBV::count(MPL::rewrap_t<Dispatcher::ComposeHelper, Filters>::ComposeBitVector(fetched));
+	}
+
+	template<typename T>
+	struct IsMutableArgument : std::conjunction<std::is_lvalue_reference<T>, std::negation<std::is_const<std::remove_reference_t<T>>>> {};
+
+	namespace Dispatcher
+	{
+		//map only reads, so reductions can run beside other readers
+		template<typename M>
+		struct ReduceTrait
+		{
+			using Trait = MPL::generic_function_trait<std::decay_t<M>>;
+			using Argument = typename Trait::argument_type;
+			using DecayArgument = MPL::map_t<std::decay_t, Argument>;
+			using RawEntityStates = MPL::filter_t<IsRawEntityState, MPL::filter_t<IsState, DecayArgument>>;
+			static_assert(MPL::size<MPL::filter_t<IsMutableArgument, Argument>>{} == 0, "map must only read!");
+
+			using ExplictFilters = MPL::filter_t<is_filter, DecayArgument>;
+			using ImplictFilters = MPL::map_t<DefaultFilter, RawEntityStates>;
+			using Filters = typename FixFilters<ExplictFilters, ImplictFilters>::type;
+			using Helper = MPL::rewrap_t<EntityDispatchHelper, DecayArgument>;
+			static_assert(MPL::size<Filters>{} > 0 || MPL::contain_v<Entity, DecayArgument>, "nothing to reduce over!");
+		};
+	}
+
+	//map(values...) of every entity of its query folded into identity by combine, in id order
+	template<typename T, typename M, typename C, typename S>
+	T Reduce(S states, T identity, M&& map, C&& combine)
+	{
+		using Trait = Dispatcher::ReduceTrait<M>;
+		typename Dispatcher::CheckFilters<typename Trait::ExplictFilters>::type checker; (void)checker;
+		using Helper = typename Trait::Helper;
+		T result = std::move(identity);
+		const auto available{ MPL::rewrap_t<Dispatcher::ComposeHelper, typename Trait::Filters>::ComposeBitVector(states) };
+		HBV::for_each_range(available, [&states, &map, &combine, &result](index_t i)
+		{
+			result = combine(std::move(result), Helper::Dispatch(states, i, map));
+		}, [&states, &map, &combine, &result](index_t begin, index_t end)
+		{
+			for (index_t i = begin; i < end; ++i)
+				result = combine(std::move(result), Helper::Dispatch(states, i, map));
+		});
+		return result;
+	}
+
+	template<typename T, typename M, typename C>
+	T Reduce(States &states, T identity, M&& map, C&& combine)
+	{
+		return Reduce(FetchFor(states, map), std::move(identity), map, combine);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,345 @@
+#pragma once
+#include <string>
+#include <cstring>
+#include "EntityState.h"
+
+namespace ESL
+{
+	//a component described at runtime, for plugins and data driven content
+	//null functions mean plain bytes: zero filled, copied by memcpy and nothing to destroy
+	//a type with move but no copy can't be copied
+	struct ComponentDesc
+	{
+		std::string name;
+		std::size_t size;
+		std::size_t align;
+		void(*construct)(void* dst) = nullptr;
+		void(*copy)(void* dst, const void* src) = nullptr;
+		void(*move)(void* dst, void* src) = nullptr;
+		void(*destroy)(void* value) = nullptr;
+	};
+
+	//descriptor of a compiled type, to share it with runtime content
+	template<typename T>
+	ComponentDesc DescribeComponent(std::string name)
+	{
+		ComponentDesc desc{ std::move(name), sizeof(T), alignof(T) };
+		if constexpr(!std::is_trivially_default_constructible_v<T>)
+			desc.construct = [](void* dst) { new(dst) T{}; };
+		if constexpr(!std::is_trivially_copyable_v<T>)
+		{
+			if constexpr(std::is_copy_constructible_v<T>)
+				desc.copy = [](void* dst, const void* src) { new(dst) T{ *static_cast<const T*>(src) }; };
+			desc.move = [](void* dst, void* src) { new(dst) T{ std::move(*static_cast<T*>(src)) }; };
+		}
+		if constexpr(!std::is_trivially_destructible_v<T>)
+			desc.destroy = [](void* value) { static_cast<T*>(value)->~T(); };
+		return desc;
+	}
+
+	//values of a runtime component in one raw column indexed by entity id
+	//it has no tracers, iterate it with DispatchDynamic
+	class DynamicState : public EntityStateBase
+	{
+		CountingResource _resource;
+		ComponentDesc _desc;
+		std::size_t _stride;
+		HBV::bit_vector _entity;
+		char* _data = nullptr;
+		index_t _capacity = 0u;
+
+		char* At(index_t e) const noexcept
+		{
+			return _data + std::size_t(e) * _stride;
+		}
+
+		void Destroy(index_t e) noexcept
+		{
+			if (_desc.destroy != nullptr)
+				_desc.destroy(At(e));
+		}
+
+		void CopyTo(void* dst, const void* src) noexcept
+		{
+			if (_desc.copy != nullptr)
+				_desc.copy(dst, src);
+			else
+			{
+				assert(_desc.move == nullptr && "move only components can't be copied");
+				memcpy(dst, src, _desc.size);
+			}
+		}
+
+		//move construct dst and destroy src
+		void Relocate(void* dst, void* src) noexcept
+		{
+			if (_desc.move == nullptr)
+				memcpy(dst, src, _desc.size);
+			else
+			{
+				_desc.move(dst, src);
+				if (_desc.destroy != nullptr)
+					_desc.destroy(src);
+			}
+		}
+
+		std::size_t Bytes(index_t capacity) const noexcept
+		{
+			return (std::max)(_stride * capacity, std::size_t(1u));
+		}
+
+		void Reserve(index_t n)
+		{
+			if (n <= _capacity)
+				return;
+			index_t capacity = (std::max)(n, _capacity * 2u);
+			char* data = (char*)_resource.allocate(Bytes(capacity), _desc.align);
+			//slots without a value stay zero, Save writes the whole column
+			std::size_t kept = _desc.move == nullptr ? _stride * _capacity : 0u;
+			memset(data + kept, 0, _stride * capacity - kept);
+			if (_data != nullptr)
+			{
+				if (_desc.move == nullptr)
+					memcpy(data, _data, _stride * _capacity);
+				else
+					HBV::for_each(_entity, [this, data](index_t e)
+					{
+						Relocate(data + std::size_t(e) * _stride, At(e));
+					});
+				_resource.deallocate(_data, Bytes(_capacity), _desc.align);
+			}
+			_data = data;
+			_capacity = capacity;
+		}
+
+		//make room for e and destroy its old value, returns the slot
+		char* Prepare(index_t e)
+		{
+			Reserve(e + 1u);
+			if (_entity.size() <= e)
+				_entity.grow_to(e + 64 * 64);
+			if (Contain(e))
+				Destroy(e);
+			else
+				_entity.set(e, true);
+			return At(e);
+		}
+
+	protected:
+		void BatchInstantiate(index_t begin, index_t end, index_t proto) override
+		{
+			Reserve(end);
+			for (index_t i = begin; i < end; ++i)
+				Instantiate(i, proto);
+		}
+
+		bool Instantiable() const noexcept override
+		{
+			return Forkable();
+		}
+
+		void BatchRemove(const HBV::bit_vector& remove) override
+		{
+			if (_desc.destroy != nullptr)
+				HBV::for_each(HBV::compose(HBV::and_op, remove, _entity), [this](index_t e)
+				{
+					Destroy(e);
+				});
+			_entity.merge<true>(remove);
+		}
+
+		void SwapBuffers() override {}
+
+		std::string Name() const override
+		{
+			return _desc.name;
+		}
+
+		//construct only fills values, they are still plain bytes
+		bool Savable() const noexcept override
+		{
+			return _desc.copy == nullptr && _desc.move == nullptr && _desc.destroy == nullptr;
+		}
+
+		void Save(SnapshotWriter& out) const override
+		{
+			assert(Savable());
+			_entity.save(out);
+			out.Write(_capacity);
+			out.Align();
+			out.Write(_data, _stride * _capacity);
+		}
+
+		void Load(SnapshotReader& in) override
+		{
+			assert(_entity.empty() && "load into an empty state");
+			_entity.load(in);
+			index_t capacity = in.Read<index_t>();
+			in.Align();
+			auto data = in.Read(capacity, _stride);
+			Reserve(capacity);
+			memcpy(_data, data, _stride * capacity);
+		}
+
+	public:
+		DynamicState(ComponentDesc desc, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _resource(resource), _desc(std::move(desc)),
+			_stride((_desc.size + _desc.align - 1) / _desc.align * _desc.align), _entity(10u, false, &_resource) {}
+
+		//a fork of other, the column is copied
+		DynamicState(const DynamicState& other, std::pmr::memory_resource* resource)
+			: _resource(resource), _desc(other._desc), _stride(other._stride), _entity(other._entity, &_resource)
+		{
+			assert(other.Forkable());
+			if (other._data == nullptr)
+				return;
+			Reserve(other._capacity);
+			if (_desc.copy == nullptr)
+				memcpy(_data, other._data, _stride * _capacity);
+			else
+				HBV::for_each(_entity, [this, &other](index_t e)
+				{
+					CopyTo(At(e), other.At(e));
+				});
+		}
+
+		DynamicState(const DynamicState&) = delete;
+		DynamicState& operator=(const DynamicState&) = delete;
+
+		//move only values can't be copied into a fork
+		bool Forkable() const noexcept
+		{
+			return _desc.copy != nullptr || _desc.move == nullptr;
+		}
+
+		~DynamicState()
+		{
+			if (_data == nullptr)
+				return;
+			if (_desc.destroy != nullptr)
+				HBV::for_each(_entity, [this](index_t e)
+				{
+					Destroy(e);
+				});
+			_resource.deallocate(_data, Bytes(_capacity), _desc.align);
+		}
+
+		const ComponentDesc& Desc() const noexcept
+		{
+			return _desc;
+		}
+
+		//value of entity e is at Data() + e * Stride(), moved by any create that grows the column
+		char* Data() noexcept
+		{
+			return _data;
+		}
+
+		std::size_t Stride() const noexcept
+		{
+			return _stride;
+		}
+
+		const HBV::bit_vector& Available() const noexcept
+		{
+			return _entity;
+		}
+
+		void* Get(index_t e) noexcept
+		{
+			assert(Contain(e));
+			return At(e);
+		}
+
+		const void* Get(index_t e) const noexcept
+		{
+			assert(Contain(e));
+			return At(e);
+		}
+
+		//default value
+		void* Create(index_t e)
+		{
+			char* slot = Prepare(e);
+			if (_desc.construct != nullptr)
+				_desc.construct(slot);
+			else
+				memset(slot, 0, _desc.size);
+			return slot;
+		}
+
+		//value must not live in this state
+		void* Create(index_t e, const void* value)
+		{
+			char* slot = Prepare(e);
+			CopyTo(slot, value);
+			return slot;
+		}
+
+		//value is moved from, it must not live in this state
+		void* Emplace(index_t e, void* value)
+		{
+			char* slot = Prepare(e);
+			if (_desc.move != nullptr)
+				_desc.move(slot, value);
+			else
+				memcpy(slot, value, _desc.size);
+			return slot;
+		}
+
+		bool Contain(index_t e) const noexcept override
+		{
+			return _entity.contain(e);
+		}
+
+		void ResetTracers() override {}
+
+		void Remove(index_t e) override
+		{
+			assert(Contain(e));
+			Destroy(e);
+			_entity.set(e, false);
+		}
+
+		void Instantiate(index_t e, index_t proto) override
+		{
+			assert(e != proto);
+			char* slot = Prepare(e);
+			CopyTo(slot, At(proto));
+		}
+
+		void Permute(index_t begin, const std::vector<index_t>& order) override
+		{
+			index_t n = (index_t)order.size();
+			index_t end = begin + n;
+			Reserve(end);
+			if (_entity.size() <= end)
+				_entity.grow_to(end + 64 * 64);
+			char* temp = (char*)_resource.allocate(Bytes(n), _desc.align);
+			for (index_t i = 0; i < n; ++i)
+				if (Contain(order[i]))
+					Relocate(temp + std::size_t(i) * _stride, At(order[i]));
+			for (index_t i = 0; i < n; ++i)
+				if (Contain(order[i]))
+					Relocate(At(begin + i), temp + std::size_t(i) * _stride);
+			_resource.deallocate(temp, Bytes(n), _desc.align);
+			HBV::permute(_entity, begin, order);
+		}
+
+		std::size_t AllocatedBytes() const noexcept override
+		{
+			return _resource.Bytes();
+		}
+
+		void Measure(StateMemory& memory) const override
+		{
+			memory.name = _desc.name;
+			memory.live = _entity.count();
+			memory.capacity = _capacity;
+			memory.container = _data != nullptr ? Bytes(_capacity) : 0u;
+			memory.layers = _entity.bytes();
+			memory.tracers = 0u;
+			memory.allocated = _resource.Bytes();
+		}
+	};
+}
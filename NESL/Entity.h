@@ -60,6 +60,7 @@ namespace ESL
 			if (end + n > _generation.size())
 				GrowTo(end + n);
 			_freeCount-=n;
+			_dead.set_range(end, end + n, false);
 			_alive.set_range(end, end + n, true);
 			for (index_t i = end; i < end + n; ++i)
 				++_generation[i];
@@ -89,6 +90,47 @@ namespace ESL
 			GrowTo(_generation.size() * 3u / 2u + base);
 		}
 
+		template<typename Order>
+		void Permute(index_t begin, const Order& order)
+		{
+			lni::vector<Generation> generation(order.size());
+			for (index_t i = 0; i < order.size(); ++i)
+				generation[i] = _generation[order[i]];
+			for (index_t i = 0; i < order.size(); ++i)
+				_generation[begin + i] = generation[i];
+			HBV::permute(_dead, begin, order);
+			HBV::permute(_alive, begin, order);
+			HBV::permute(_killed, begin, order);
+		}
+
+		template<typename Writer>
+		void Save(Writer& out) const
+		{
+			out.Write(_freeCount);
+			out.Write(_killedCount);
+			out.Write(uint64_t(_generation.size()));
+			out.Write(_generation.data(), _generation.size() * sizeof(Generation));
+			_dead.save(out);
+			_alive.save(out);
+			_killed.save(out);
+		}
+
+		template<typename Reader>
+		void Load(Reader& in)
+		{
+			_freeCount = in.template Read<index_t>();
+			_killedCount = in.template Read<index_t>();
+			std::size_t size = in.template Read<uint64_t>();
+			auto generation = in.Read(size, sizeof(Generation));
+			_generation.resize(size);
+			memcpy(_generation.data(), generation, size * sizeof(Generation));
+			_dead.load(in);
+			_alive.load(in);
+			_killed.load(in);
+			//ids of the bit_vectors index the generations
+			in.Require(_dead.size() <= size && _alive.size() <= size && _killed.size() <= size, "snapshot generations don't match the entities");
+		}
+
 		friend class States;
 	public:
 		Entities() : _generation(10u), _dead(10u, true), _killed(10u), _alive(10u, false), _freeCount(10u), _killedCount(0u) {}
@@ -2,38 +2,119 @@
 #include "HBV.h"
 #include "Entity.h"
 #include <unordered_map>
+#include <typeinfo>
+#include <stdexcept>
 #include "MPL.h"
 #include "Trace.h"
+#include "Memory.h"
+#include "Snapshot.h"
 
 namespace ESL
 {
+	//memory of one entity state, see States::MemoryReport
+	struct StateMemory
+	{
+		std::string name;
+		//entities holding the state and values the container has room for
+		std::size_t live = 0u;
+		std::size_t capacity = 0u;
+		//values, indices and free lists of the container and the journal
+		std::size_t container = 0u;
+		//the entity bit_vector, layer0 first
+		std::array<std::size_t, HBV::LayerCount> layers{};
+		std::size_t tracers = 0u;
+		//taken from the allocator of the state, counts what the estimates above miss
+		std::size_t allocated = 0u;
+	};
+
 	struct EntityStateBase
 	{
 		virtual bool Contain(index_t e) const = 0;
 		virtual void ResetTracers() = 0;
 		virtual void Remove(index_t e) = 0;
 		virtual void Instantiate(index_t e, index_t proto) = 0;
+		//entity begin + i takes the state of entity order[i]
+		virtual void Permute(index_t begin, const std::vector<index_t>& order) = 0;
+		//bytes allocated by the container, tracers and bit_vector of this state
+		virtual std::size_t AllocatedBytes() const = 0;
+		//fills memory in place so a reused report doesn't allocate
+		virtual void Measure(StateMemory& memory) const = 0;
 	protected:
 		friend class States;
 		virtual void BatchInstantiate(index_t begin, index_t end, index_t proto) = 0;
+		//move only states can't be copied from a prototype, Instantiate throws std::logic_error
+		virtual bool Instantiable() const = 0;
 		virtual void BatchRemove(const HBV::bit_vector& remove) = 0;
+		virtual void SwapBuffers() = 0;
+		//snapshots match states by name, only states of plain bytes are savable
+		virtual std::string Name() const = 0;
+		virtual bool Savable() const = 0;
+		virtual void Save(SnapshotWriter& out) const = 0;
+		//into an empty state, tracers start reset
+		virtual void Load(SnapshotReader& in) = 0;
 	};
 
 	template<typename T>
 	using SupportBatchCreate = decltype(&T::BatchCreate);
 
+	template<typename T>
+	using SupportSave = decltype(&T::Save);
+
+	template<typename T>
+	using SupportMeasure = decltype(&T::Bytes);
+
+	//containers copied into a fork, has is the entity set of the fork
+	template<typename T>
+	using SupportFork = decltype(T(std::declval<const T&>(), std::declval<const HBV::bit_vector&>(), std::declval<std::pmr::memory_resource*>()));
+
 	template<typename T>
 	using SupportBatchRemove = decltype(&T::BatchRemove);
 
 	template<typename T>
 	using SupportInstantiate = decltype(&T::Instantiate);
 
+	template<typename T>
+	using SupportPermute = decltype(&T::Permute);
+
+	template<typename T>
+	using SupportSwap = decltype(&T::Swap);
+
+	//copy on write containers, pages shared with a fork are copied before workers write them
+	template<typename T>
+	using SupportOwnPages = decltype(&T::template OwnPages<HBV::bit_vector>);
+
+	template<typename T, typename It>
+	using SupportBatchCreateFrom = decltype(std::declval<T&>().BatchCreateFrom(index_t{}, index_t{}, std::declval<It>()));
+
+	template<typename T, typename... Ts>
+	using SupportEmplace = decltype(std::declval<T&>().Emplace(index_t{}, std::declval<Ts>()...));
+
 	using bit_vector_and2 = decltype(HBV::compose(HBV::and_op, HBV::bit_vector{}, HBV::bit_vector{}));
 
+	template<typename T>
+	class Placeholder;
+
+	template<typename T>
+	class Hash;
+
+	struct NoJournal
+	{
+		NoJournal(std::size_t, std::pmr::memory_resource*) noexcept {}
+		NoJournal(const NoJournal&, std::pmr::memory_resource*) noexcept {}
+	};
+
+	//tag containers hold no value, the state is just its bit_vector
+	template<typename T>
+	struct IsTag : std::false_type {};
+
+	template<typename T>
+	struct IsTag<Placeholder<T>> : std::true_type {};
+
 	template<typename T, Trace... types>
 	class EntityStateGeneric : public EntityStateBase
 	{
 	protected:
+		CountingResource _resource;
 		HBV::bit_vector _entity;
 		T _container;
 
@@ -47,9 +128,22 @@ namespace ESL
 
 		using value_type_t = typename value_type<T>::type;
 
+		//move only values can be instantiated only by containers that share them
+		static constexpr bool CanInstantiate = IsTag<T>{} || MPL::is_detected<SupportInstantiate, T>{} || std::is_copy_constructible_v<value_type_t>;
+		static constexpr bool Journaled = ((types == Trace::Journal) || ...);
+		//final values of removed entities, released with the tracers, tags only keep the ids
+		static constexpr bool Journaling = Journaled && !IsTag<T>{};
+		std::conditional_t<Journaling, Hash<value_type_t>, NoJournal> _journal;
+
+		void Record(index_t e)
+		{
+			if constexpr(Journaling)
+				_journal.Emplace(e, std::move(_container.Get(e)));
+		}
+
 		friend class States;
 
-		void BatchCreate(index_t begin, index_t end, const value_type_t& arg) noexcept
+		void BatchCreate(index_t begin, index_t end, const value_type_t& arg)
 		{
 			MPL::for_tuple(_tracers, [begin, end](auto& tracer)
 			{
@@ -69,10 +163,59 @@ namespace ESL
 			}
 		}
 
-		void BatchInstantiate(index_t begin, index_t end, index_t proto) noexcept
+		//value i of the source goes to begin + i
+		template<typename It>
+		void BatchCreateFrom(index_t begin, index_t end, It first)
 		{
-			const value_type_t& prototype = Get(proto);
-			BatchCreate(begin, end, prototype);
+			MPL::for_tuple(_tracers, [begin, end](auto& tracer)
+			{
+				tracer.BatchCreate(begin, end);
+			});
+			if (_entity.size() <= end)
+				_entity.grow_to(end);
+			_entity.set_range(begin, end, true);
+			if constexpr(MPL::is_detected<SupportBatchCreateFrom, T, It>{})
+			{
+				_container.BatchCreateFrom(begin, end, first);
+			}
+			else if constexpr(MPL::is_detected<SupportEmplace, T, decltype(*first)>{})
+			{
+				for (index_t i = begin; i < end; ++i, ++first)
+					_container.Emplace(i, *first);
+			}
+			else
+			{
+				for (index_t i = begin; i < end; ++i, ++first)
+					_container.Create(i, *first);
+			}
+		}
+
+		void SwapBuffers() noexcept
+		{
+			if constexpr(MPL::is_detected<SupportSwap, T>{})
+				_container.Swap();
+		}
+
+		void BatchInstantiate(index_t begin, index_t end, index_t proto)
+		{
+			if constexpr(!CanInstantiate)
+				throw std::logic_error("move only states can't be instantiated");
+			if constexpr(IsTag<T>{})
+			{
+				BatchCreate(begin, end, value_type_t{});
+			}
+			else if constexpr(std::is_copy_constructible_v<value_type_t>)
+			{
+				//a copy, BatchCreate may grow the container under a reference
+				const value_type_t prototype = Get(proto);
+				BatchCreate(begin, end, prototype);
+			}
+			else
+			{
+				//move only values the container shares
+				for (index_t e = begin; e < end; ++e)
+					Instantiate(e, proto);
+			}
 		}
 
 		//עremoveһ,Ҫһcompose
@@ -83,6 +226,13 @@ namespace ESL
 			{
 				tracer.BatchRemove(vector);
 			});
+			if constexpr(Journaling)
+			{
+				HBV::for_each(vector, [this](index_t i)
+				{
+					Record(i);
+				});
+			}
 			if constexpr(MPL::is_detected<SupportBatchRemove, T>{})
 			{
 				_container.BatchRemove(vector);
@@ -96,9 +246,127 @@ namespace ESL
 			}
 			_entity.merge<true>(remove);
 		}
+
+		//container, value and tracers, a file only loads into a state of the same layout
+		//memory reports use the same name
+		static const char* TypeName() noexcept
+		{
+			return typeid(EntityStateGeneric).name();
+		}
+
+		std::string Name() const
+		{
+			return TypeName();
+		}
+
+		bool Savable() const noexcept
+		{
+			return IsTag<T>{} || std::is_trivially_copyable_v<value_type_t>;
+		}
+
+		bool Instantiable() const noexcept
+		{
+			return CanInstantiate;
+		}
+
+		//containers without a bulk layout write their values in id order
+		void Save(SnapshotWriter& out) const
+		{
+			_entity.save(out);
+			if constexpr(IsTag<T>{} || !std::is_trivially_copyable_v<value_type_t>)
+			{
+				assert(IsTag<T>{} && "state is not savable");
+			}
+			else if constexpr(MPL::is_detected<SupportSave, T>{})
+			{
+				_container.Save(out);
+			}
+			else
+			{
+				uint64_t count = 0u;
+				HBV::for_each(_entity, [&count](index_t) { ++count; });
+				out.Write(count);
+				out.Align(alignof(value_type_t));
+				HBV::for_each(_entity, [this, &out](index_t e)
+				{
+					out.Write(_container.Get(e));
+				});
+			}
+		}
+
+		void Load(SnapshotReader& in)
+		{
+			assert(_entity.empty() && "load into an empty state");
+			_entity.load(in);
+			if constexpr(IsTag<T>{} || !std::is_trivially_copyable_v<value_type_t>)
+			{
+				assert(IsTag<T>{} && "state is not savable");
+			}
+			else if constexpr(MPL::is_detected<SupportSave, T>{})
+			{
+				_container.Load(in);
+			}
+			else
+			{
+				uint64_t count = in.Read<uint64_t>();
+				in.Require(count == _entity.count(), "snapshot values don't match their entities");
+				in.Align(alignof(value_type_t));
+				auto values = (const value_type_t*)in.Read(count, sizeof(value_type_t));
+				HBV::for_each(_entity, [this, &values](index_t e)
+				{
+					_container.Create(e, *values++);
+				});
+			}
+			MPL::for_tuple(_tracers, [this](auto& tracer)
+			{
+				tracer.Restore(_entity);
+			});
+		}
 	public:
+		//every allocation of the state goes through _resource, which counts and forwards to the world's resource
 		template<typename... Ts>
-		EntityStateGeneric(Ts&&... args) noexcept : _entity(10u), _container(std::forward<Ts>(args)...) {}
+		EntityStateGeneric(std::pmr::memory_resource* resource, Ts&&... args)
+			: _resource(resource), _entity(10u, false, &_resource), 
+			_container(std::forward<Ts>(args)..., &_resource), _tracers(Tracer<types>{ &_resource }...),
+			_journal(10u, &_resource) {}
+
+		//containers and journals that can be copied into a fork, see States::Fork
+		static constexpr bool Forkable = MPL::is_detected<SupportFork, T>{} && std::is_copy_constructible_v<value_type_t>;
+
+		//bit_vectors share their blocks with other, the container shares what it can and copies the rest
+		EntityStateGeneric(const EntityStateGeneric& other, std::pmr::memory_resource* resource)
+			: _resource(resource), _entity(other._entity, &_resource),
+			_container(other._container, _entity, &_resource),
+			_tracers(Tracer<types>{ std::get<Tracer<types>>(other._tracers), &_resource }...),
+			_journal(other._journal, &_resource) {}
+
+		std::size_t AllocatedBytes() const noexcept
+		{
+			return _resource.Bytes();
+		}
+
+		void Measure(StateMemory& memory) const
+		{
+			//same as Name(), assigned from the chars so a reused report keeps its buffer
+			memory.name = TypeName();
+			memory.live = _entity.count();
+			memory.layers = _entity.bytes();
+			memory.capacity = 0u;
+			memory.container = 0u;
+			if constexpr(MPL::is_detected<SupportMeasure, T>{})
+			{
+				memory.capacity = _container.Capacity();
+				memory.container = _container.Bytes();
+			}
+			if constexpr(Journaling)
+				memory.container += _journal.Bytes();
+			memory.tracers = 0u;
+			MPL::for_tuple(_tracers, [&memory](auto& tracer)
+			{
+				memory.tracers += tracer.Bytes();
+			});
+			memory.allocated = _resource.Bytes();
+		}
 
 		T& Raw() noexcept
 		{
@@ -116,11 +384,29 @@ namespace ESL
 			return ComposeTracer<type, types...>(_tracers, _entity);
 		}
 
+		//changes stamped in (since, last], from the Versioned tracer
+		template<Trace type>
+		decltype(auto) Available(uint32_t since, uint32_t last) const noexcept
+		{
+			static_assert(((types == Trace::Versioned) || ...), "no versioned tracer!");
+			const auto& tracer = std::get<Tracer<Trace::Versioned>>(_tracers);
+			if constexpr(type == Trace::Create)
+				return tracer.created.since(since, last);
+			else if constexpr(type == Trace::Borrow)
+				return tracer.borrowed.since(since, last);
+			else if constexpr(type == Trace::CB)
+				return HBV::compose(HBV::or_op, tracer.created.since(since, last), tracer.borrowed.since(since, last));
+			else
+				return Available<type>();
+		}
+
 		template<Trace type>
 		void ResetTracer()
 		{
 			
 			std::get<Tracer<type>>(_tracers).Reset();
+			if constexpr(type == Trace::Journal && Journaling)
+				_journal.Clear();
 		}
 
 		void ResetTracers() noexcept
@@ -129,6 +415,50 @@ namespace ESL
 			{
 				tracer.Reset();
 			});
+			if constexpr(Journaling)
+				_journal.Clear();
+		}
+
+		//Create, Remove and Borrow flags, the copies share blocks with the tracers until either is written
+		using Flags = std::array<HBV::bit_vector, sizeof...(types)>;
+
+		Flags SaveFlags() const
+		{
+			Flags flags;
+			std::size_t i = 0u;
+			MPL::for_tuple(_tracers, [&flags, &i](const auto& tracer)
+			{
+				if constexpr(IsFlagTracer<std::decay_t<decltype(tracer)>>{})
+					flags[i] = tracer.flag;
+				++i;
+			});
+			return flags;
+		}
+
+		//drop the Create, Remove and Borrow flags set since SaveFlags, other tracers keep everything
+		void RestoreFlags(const Flags& flags)
+		{
+			std::size_t i = 0u;
+			MPL::for_tuple(_tracers, [&flags, &i](auto& tracer)
+			{
+				if constexpr(IsFlagTracer<std::decay_t<decltype(tracer)>>{})
+					tracer.flag = flags[i];
+				++i;
+			});
+		}
+
+		//entities removed since the tracers were reset, needs the Journal tracer
+		const HBV::bit_vector& Removed() const noexcept
+		{
+			static_assert(Journaled, "no journal!");
+			return std::get<Tracer<Trace::Journal>>(_tracers).flag;
+		}
+
+		//the value an entity had when it was removed
+		const value_type_t& GetRemoved(index_t e) const noexcept
+		{
+			static_assert(Journaling, "no journal!");
+			return _journal.Get(e);
 		}
 
 		auto &Get(index_t e) noexcept
@@ -147,7 +477,52 @@ namespace ESL
 			return _container.Get(e);
 		}
 
-		decltype(auto) Create(index_t e, const value_type_t& arg)  noexcept
+		//mutable access without touching the tracers, mark it with Borrow or BatchBorrow
+		auto &GetUntraced(index_t e) noexcept
+		{
+			assert(Contain(e));
+			return _container.Get(e);
+		}
+
+		//parallel writers call it before the workers run, so no worker copies a shared page
+		template<typename V>
+		void OwnPages(const V& vec)
+		{
+			if constexpr(MPL::is_detected<SupportOwnPages, T>{})
+				_container.OwnPages(vec);
+		}
+
+		void Borrow(index_t e) noexcept
+		{
+			MPL::for_tuple(_tracers, [&e](auto& tracer)
+			{
+				tracer.Change(e);
+			});
+		}
+
+		//mark a whole set of entities as borrowed, used by dispatchers after iterating it
+		template<typename V>
+		void BatchBorrow(const V& borrowed) noexcept
+		{
+			MPL::for_tuple(_tracers, [this, &borrowed](auto& tracer)
+			{
+				tracer.BatchChange(_entity.size(), borrowed);
+			});
+		}
+
+		decltype(auto) Create(index_t e, const value_type_t& arg)
+		{
+			return Emplace(e, arg);
+		}
+
+		decltype(auto) Create(index_t e, value_type_t&& arg)
+		{
+			return Emplace(e, std::move(arg));
+		}
+
+		//construct in place where the container supports it, otherwise from a temporary
+		template<typename... Ts>
+		decltype(auto) Emplace(index_t e, Ts&&... args)
 		{
 			MPL::for_tuple(_tracers, [&e](auto& tracer)
 			{
@@ -159,22 +534,36 @@ namespace ESL
 				_container.Remove(e);
 			else
 				_entity.set(e, true);
-			return _container.Create(e, arg);
+			if constexpr(MPL::is_detected<SupportEmplace, T, Ts...>{})
+				return _container.Emplace(e, std::forward<Ts>(args)...);
+			else
+				return _container.Create(e, value_type_t{ std::forward<Ts>(args)... });
 		}
 
-		void Instantiate(index_t e, index_t proto) noexcept
+		void Instantiate(index_t e, index_t proto)
 		{
+			if constexpr(!CanInstantiate)
+				throw std::logic_error("move only states can't be instantiated");
 			MPL::for_tuple(_tracers, [&e](auto& tracer)
 			{
 				tracer.Create(e);
 			});
-			if constexpr(MPL::is_detected<SupportInstantiate, T>{})
+			if (_entity.size() <= e)
+				_entity.grow_to(e + 64 * 64);
+			if constexpr(IsTag<T>{})
+			{
+				_entity.set(e, true);
+			}
+			else if constexpr(MPL::is_detected<SupportInstantiate, T>{})
 			{
 				_container.Instantiate(e, proto);
 				_entity.set(e, true);
 			}
-			else
+			else if constexpr(std::is_copy_constructible_v<value_type_t>)
+			{
 				_container.Create(e, _container.Get(proto));
+				_entity.set(e, true);
+			}
 		}
 
 		bool Contain(index_t e) const noexcept
@@ -182,6 +571,48 @@ namespace ESL
 			return _entity.contain(e);
 		}
 
+		void Permute(index_t begin, const std::vector<index_t>& order)
+		{
+			index_t end = begin + (index_t)order.size();
+			if (_entity.size() <= end)
+				_entity.grow_to(end + 64 * 64);
+			if constexpr(IsTag<T>{})
+			{
+			}
+			else if constexpr(MPL::is_detected<SupportPermute, T>{})
+			{
+				_container.Permute(begin, order, _entity);
+			}
+			else
+			{
+				//containers not indexed by id are rebuilt for the range
+				std::vector<std::pair<index_t, value_type_t>> moved;
+				for (index_t i = 0; i < order.size(); ++i)
+					if (Contain(order[i]))
+					{
+						if constexpr(std::is_copy_constructible_v<value_type_t>)
+							moved.emplace_back(begin + i, std::as_const(_container).Get(order[i]));
+						else
+							moved.emplace_back(begin + i, std::move(_container.Get(order[i])));
+					}
+				for (index_t e = begin; e < end; ++e)
+					if (Contain(e))
+						_container.Remove(e);
+				for (auto& pair : moved)
+				{
+					if constexpr(MPL::is_detected<SupportEmplace, T, value_type_t&&>{})
+						_container.Emplace(pair.first, std::move(pair.second));
+					else
+						_container.Create(pair.first, pair.second);
+				}
+			}
+			HBV::permute(_entity, begin, order);
+			MPL::for_tuple(_tracers, [begin, &order](auto& tracer)
+			{
+				tracer.Permute(begin, order);
+			});
+		}
+
 		void Remove(index_t e) noexcept
 		{
 			assert(Contain(e));
@@ -190,6 +621,7 @@ namespace ESL
 				tracer.Remove(e);
 			});
 			_entity.set(e, false);
+			Record(e);
 			_container.Remove(e);
 		}
 	};
@@ -199,7 +631,11 @@ namespace ESL
 	{
 		using Generic = EntityStateGeneric<T, types...>;
 	public:
-		EntityState() noexcept : Generic(10u) {}
+		EntityState(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: Generic(resource, 10u) {}
+
+		EntityState(const EntityState& other, std::pmr::memory_resource* resource)
+			: Generic(other, resource) {}
 	};
 
 	template<typename _Tp, typename _Alloc = std::allocator<_Tp>>
@@ -208,6 +644,7 @@ namespace ESL
 		typedef std::vector<_Tp, _Alloc> parent;
 
 	public:
+		using parent::parent;
 		using parent::capacity;
 		using parent::reserve;
 		using parent::size;
@@ -226,140 +663,916 @@ namespace ESL
 		}
 	};
 
+	//container of tag components, stores nothing
 	template<typename T>
 	class Placeholder
 	{ 
 	public:
+		Placeholder(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {}
+
+		Placeholder(const Placeholder&, const HBV::bit_vector&, std::pmr::memory_resource*) {}
+
+		void BatchCreate(index_t begin, index_t end, const T& arg)
+		{
+		}
+
+		void Create(index_t e, const T& arg)
+		{
+		}
+
+		void BatchRemove(const bit_vector_and2& remove)
+		{
+		}
+
+		void Remove(index_t e)
+		{
+		}
+	};
+
+	template<typename T, Trace... types>
+	class EntityState<Placeholder<T>, types...> : public EntityStateGeneric<Placeholder<T>, types...>
+	{
+		using Generic = EntityStateGeneric<Placeholder<T>, types...>;
+	public:
+		EntityState(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) 
+			: Generic(resource) {}
+
+		EntityState(const EntityState& other, std::pmr::memory_resource* resource)
+			: Generic(other, resource) {}
+
+		using Generic::Create;
+
+		void Create(index_t e)
+		{
+			Generic::Create(e, T{});
+		}
+
+		//a tag has no value, use it as a filter or take it by value
+		void Get(index_t e) const = delete;
+	};
+
+	template<typename S>
+	struct IsTagState : std::false_type {};
+
+	template<typename T, Trace... types>
+	struct IsTagState<EntityState<Placeholder<T>, types...>> : std::true_type {};
+
+	template<typename T>
+	struct IsVersioned : std::false_type {};
+
+	template<typename T, Trace... types>
+	struct IsVersioned<EntityState<T, types...>> : std::bool_constant<((types == Trace::Versioned) || ...)> {};
+
+	template<typename T>
+	class DoubleVec;
+
+	template<typename S>
+	struct IsDoubleBuffered : std::false_type {};
+
+	template<typename T, Trace... types>
+	struct IsDoubleBuffered<EntityState<DoubleVec<T>, types...>> : std::true_type {};
+
+	template<typename T>
+	class Vec
+	{
+		uvector<T, std::pmr::polymorphic_allocator<T>> _states;
+	public:
+
+		Vec(std::size_t sz = 10u, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) 
+			: _states(resource)
+		{
+			_states.resize(sz);
+		}
+
+		//the whole column is copied, use PagedVec for states forked often
+		Vec(const Vec& other, const HBV::bit_vector& has, std::pmr::memory_resource* resource)
+			: _states(resource)
+		{
+			_states.resize(other._states.size());
+			if constexpr(std::is_trivially_copyable_v<T>)
+				memcpy(_states.data(), other._states.data(), _states.size() * sizeof(T));
+			else
+			{
+				//the vector destroys every slot, so slots without a value get an empty one
+				for (index_t e = 0; e < _states.size(); ++e)
+				{
+					if (has.contain(e))
+						new(&_states[e]) T{ other._states[e] };
+					else
+						new(&_states[e]) T{};
+				}
+			}
+		}
 		T &Get(index_t e)
 		{
-			return *(T*)nullptr;
+			return _states[e];
+		}
+
+		const T &Get(index_t e) const
+		{
+			return _states[e];
+		}
+
+		void BatchCreate(index_t begin, index_t end, const T& arg)
+		{
+			_states.resize(end);
+			for (auto i = begin; i < end; ++i)
+				new(&_states[i]) T{ arg };
+		}
+
+		//value i goes to begin + i, contiguous trivially copyable sources are copied at once
+		template<typename It>
+		void BatchCreateFrom(index_t begin, index_t end, It first)
+		{
+			_states.resize(end);
+			if constexpr(std::is_pointer_v<It> && std::is_trivially_copyable_v<T>)
+				memcpy(&_states[begin], first, (end - begin) * sizeof(T));
+			else
+				for (auto i = begin; i < end; ++i, ++first)
+					new(&_states[i]) T{ *first };
+		}
+
+		template<typename... Ts>
+		T &Emplace(index_t e, Ts&&... args)
+		{
+			if (e >= _states.size())
+				_states.resize(e + 1u);
+			return *(new(&_states[e]) T{ std::forward<Ts>(args)... });
+		}
+
+		T &Create(index_t e, const T& arg)
+		{
+			return Emplace(e, arg);
+		}
+
+		void BatchRemove(const bit_vector_and2& remove)
+		{
+			if constexpr(!std::is_pod_v<T>)
+			{
+				HBV::for_each(remove, [this](index_t i)
+				{
+					_states[i].~T();
+				});
+			}
+		}
+
+		void Remove(index_t e)
+		{
+			if constexpr(!std::is_pod_v<T>)
+				_states[e].~T();
+		}
+
+		//the whole column, it starts on a page of the snapshot
+		void Save(SnapshotWriter& out) const
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "only bytes are saved!");
+			out.Write(uint64_t(_states.size()));
+			out.Align();
+			out.Write(_states.data(), _states.size() * sizeof(T));
+		}
+
+		void Load(SnapshotReader& in)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "only bytes are loaded!");
+			std::size_t size = in.Read<uint64_t>();
+			in.Align();
+			auto states = in.Read(size, sizeof(T));
+			_states.resize(size);
+			memcpy(_states.data(), states, size * sizeof(T));
+		}
+
+		void Permute(index_t begin, const std::vector<index_t>& order, const HBV::bit_vector& has)
+		{
+			index_t n = (index_t)order.size();
+			if (_states.size() < begin + n)
+				_states.resize(begin + n);
+			std::vector<std::aligned_storage_t<sizeof(T), alignof(T)>> buffer(n);
+			T* temp = (T*)buffer.data();
+			if constexpr(std::is_trivially_copyable_v<T>)
+			{
+				memcpy(temp, &_states[begin], n * sizeof(T));
+				for (index_t i = 0; i < n; ++i)
+					_states[begin + i] = temp[order[i] - begin];
+			}
+			else
+			{
+				for (index_t i = 0; i < n; ++i)
+					if (has.contain(begin + i))
+					{
+						new(&temp[i]) T{ std::move(_states[begin + i]) };
+						_states[begin + i].~T();
+					}
+				for (index_t i = 0; i < n; ++i)
+					if (has.contain(order[i]))
+					{
+						new(&_states[begin + i]) T{ std::move(temp[order[i] - begin]) };
+						temp[order[i] - begin].~T();
+					}
+			}
+		}
+
+		std::size_t Capacity() const noexcept
+		{
+			return _states.capacity();
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return _states.capacity() * sizeof(T);
+		}
+	};
+
+	//Vec over address space reserved once for every possible id, growing only commits
+	//more pages so it never copies, pages are huge page sized where the OS allows
+	template<typename T>
+	class VirtualVec
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "VirtualVec only holds trivially copyable states!");
+		//ids are limited to 24 bits by Entity
+		static constexpr std::size_t MaxCount = 1u << 24;
+		static constexpr std::size_t Reserved = MaxCount * sizeof(T);
+		T* _states;
+		std::size_t _committed = 0u;
+
+		//out of address space or memory throws std::bad_alloc, which the creating calls of EntityState pass on
+		void CommitTo(std::size_t n)
+		{
+			std::size_t bytes = n * sizeof(T);
+			if (bytes <= _committed)
+				return;
+			if (bytes > Reserved)
+				throw std::bad_alloc{};
+			std::size_t to = (std::min)(VirtualMemory::AlignUp(bytes), Reserved);
+			if (!VirtualMemory::Commit((char*)_states + _committed, to - _committed))
+				throw std::bad_alloc{};
+			_committed = to;
+		}
+
+		static T* ReserveStates()
+		{
+			void* p = VirtualMemory::Reserve(Reserved);
+			if (p == nullptr)
+				throw std::bad_alloc{};
+			return (T*)p;
+		}
+
+		//the destructor doesn't run if a constructor throws
+		void CommitOrRelease(std::size_t n)
+		{
+			try
+			{
+				CommitTo(n);
+			}
+			catch (...)
+			{
+				VirtualMemory::Release(_states, Reserved);
+				throw;
+			}
+		}
+
+	public:
+		VirtualVec(std::size_t sz = 10u, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _states(ReserveStates())
+		{
+			CommitOrRelease(sz);
+		}
+
+		VirtualVec(const VirtualVec& other)
+			: _states(ReserveStates())
+		{
+			CommitOrRelease(other._committed / sizeof(T));
+			memcpy(_states, other._states, other._committed);
+		}
+
+		VirtualVec(const VirtualVec& other, const HBV::bit_vector& has, std::pmr::memory_resource* resource)
+			: VirtualVec(other) {}
+
+		~VirtualVec()
+		{
+			VirtualMemory::Release(_states, Reserved);
+		}
+
+		T &Get(index_t e)
+		{
+			return _states[e];
+		}
+
+		const T &Get(index_t e) const
+		{
+			return _states[e];
+		}
+
+		void BatchCreate(index_t begin, index_t end, const T& arg)
+		{
+			CommitTo(end);
+			std::fill(_states + begin, _states + end, arg);
+		}
+
+		template<typename It>
+		void BatchCreateFrom(index_t begin, index_t end, It first)
+		{
+			CommitTo(end);
+			if constexpr(std::is_pointer_v<It>)
+				memcpy(_states + begin, first, (end - begin) * sizeof(T));
+			else
+				std::copy_n(first, end - begin, _states + begin);
+		}
+
+		template<typename... Ts>
+		T &Emplace(index_t e, Ts&&... args)
+		{
+			CommitTo(e + 1u);
+			return *(new(&_states[e]) T{ std::forward<Ts>(args)... });
+		}
+
+		T &Create(index_t e, const T& arg)
+		{
+			return Emplace(e, arg);
+		}
+
+		void Remove(index_t e) {}
+
+		void Save(SnapshotWriter& out) const
+		{
+			out.Write(uint64_t(_committed));
+			out.Align();
+			out.Write(_states, _committed);
+		}
+
+		void Load(SnapshotReader& in)
+		{
+			std::size_t bytes = in.Read<uint64_t>();
+			in.Align();
+			auto states = in.Read(bytes);
+			CommitTo((bytes + sizeof(T) - 1) / sizeof(T));
+			memcpy(_states, states, bytes);
+		}
+
+		void Permute(index_t begin, const std::vector<index_t>& order, const HBV::bit_vector& has)
+		{
+			index_t n = (index_t)order.size();
+			CommitTo(begin + n);
+			std::vector<T> temp(_states + begin, _states + begin + n);
+			for (index_t i = 0; i < n; ++i)
+				_states[begin + i] = temp[order[i] - begin];
+		}
+
+		std::size_t Capacity() const noexcept
+		{
+			return _committed / sizeof(T);
+		}
+
+		//committed pages, the reserved address space costs nothing
+		std::size_t Bytes() const noexcept
+		{
+			return _committed;
+		}
+	};
+
+	//Vec in fixed size pages, forks share the pages and copy one when they first write it
+	//a page goes back to the resource that allocated it, which must outlive the forks
+	template<typename T>
+	class PagedVec
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "PagedVec copies pages by bytes!");
+		static constexpr index_t PageBits = 12u;
+		static constexpr index_t PageSize = 1u << PageBits;
+		static constexpr index_t PageMask = PageSize - 1u;
+		struct Page
+		{
+			std::atomic<uint32_t> refs;
+			std::pmr::memory_resource* resource;
+			T values[PageSize];
+		};
+		std::pmr::memory_resource* _resource;
+		std::pmr::vector<Page*> _pages;
+
+		Page* Allocate()
+		{
+			Page* page = new(_resource->allocate(sizeof(Page), alignof(Page))) Page;
+			page->refs.store(1u, std::memory_order_relaxed);
+			page->resource = _resource;
+			return page;
+		}
+
+		static void Release(Page* page) noexcept
+		{
+			if (page->refs.fetch_sub(1u, std::memory_order_acq_rel) == 1u)
+				page->resource->deallocate(page, sizeof(Page), alignof(Page));
+		}
+
+		//the page of e for writing, allocated or copied from a shared one
+		T* Own(index_t e)
+		{
+			index_t p = e >> PageBits;
+			if (_pages.size() <= p)
+				_pages.resize(p + 1u, nullptr);
+			Page*& page = _pages[p];
+			if (page == nullptr)
+				page = Allocate();
+			else if (page->refs.load(std::memory_order_relaxed) != 1u)
+			{
+				Page* shared = page;
+				page = Allocate();
+				memcpy(page->values, shared->values, sizeof(shared->values));
+				Release(shared);
+			}
+			return page->values;
+		}
+
+	public:
+		PagedVec(std::size_t sz = 10u, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _resource(resource), _pages(resource) {}
+
+		PagedVec(const PagedVec& other, const HBV::bit_vector& has, std::pmr::memory_resource* resource)
+			: _resource(resource), _pages(other._pages, resource)
+		{
+			for (auto page : _pages)
+				if (page != nullptr)
+					page->refs.fetch_add(1u, std::memory_order_relaxed);
+		}
+
+		PagedVec(const PagedVec&) = delete;
+		PagedVec& operator=(const PagedVec&) = delete;
+
+		~PagedVec()
+		{
+			for (auto page : _pages)
+				if (page != nullptr)
+					Release(page);
+		}
+
+		//copies a shared page on the first write, not safe for workers writing the same page, see OwnPages
+		T &Get(index_t e)
+		{
+			Page* page = _pages[e >> PageBits];
+			if (page->refs.load(std::memory_order_relaxed) != 1u)
+				return Own(e)[e & PageMask];
+			return page->values[e & PageMask];
+		}
+
+		//copy every shared page vec touches, Get then never copies and workers can write them together
+		template<typename V>
+		void OwnPages(const V& vec)
+		{
+			static_assert(PageBits == HBV::BitsPerLayer * 2u, "a page is a layer1 node");
+			HBV::for_each<1>(vec, [this](index_t p)
+			{
+				if (p < _pages.size() && _pages[p] != nullptr && _pages[p]->refs.load(std::memory_order_relaxed) != 1u)
+					Own(p << PageBits);
+			});
+		}
+
+		const T &Get(index_t e) const
+		{
+			return _pages[e >> PageBits]->values[e & PageMask];
+		}
+
+		void BatchCreate(index_t begin, index_t end, const T& arg)
+		{
+			for (index_t e = begin; e < end;)
+			{
+				index_t last = (std::min)(end, (e | PageMask) + 1u);
+				T* values = Own(e);
+				std::fill(values + (e & PageMask), values + (e & PageMask) + (last - e), arg);
+				e = last;
+			}
+		}
+
+		template<typename It>
+		void BatchCreateFrom(index_t begin, index_t end, It first)
+		{
+			for (index_t e = begin; e < end;)
+			{
+				index_t last = (std::min)(end, (e | PageMask) + 1u);
+				T* values = Own(e);
+				//first has to go on across pages, copy_n doesn't hand it back
+				for (; e < last; ++e, ++first)
+					values[e & PageMask] = *first;
+			}
+		}
+
+		template<typename... Ts>
+		T &Emplace(index_t e, Ts&&... args)
+		{
+			return *(new(&Own(e)[e & PageMask]) T{ std::forward<Ts>(args)... });
+		}
+
+		T &Create(index_t e, const T& arg)
+		{
+			return Emplace(e, arg);
+		}
+
+		void Remove(index_t e) {}
+
+		void Permute(index_t begin, const std::vector<index_t>& order, const HBV::bit_vector& has)
+		{
+			index_t n = (index_t)order.size();
+			std::vector<T> temp(n);
+			for (index_t i = 0; i < n; ++i)
+				if (has.contain(order[i]))
+					temp[i] = std::as_const(*this).Get(order[i]);
+			for (index_t i = 0; i < n; ++i)
+				if (has.contain(order[i]))
+					Own(begin + i)[(begin + i) & PageMask] = temp[i];
+		}
+
+		//pages shared with forks or the world forked from
+		std::size_t SharedPages() const noexcept
+		{
+			std::size_t n = 0u;
+			for (auto page : _pages)
+				n += page != nullptr && page->refs.load(std::memory_order_relaxed) > 1u;
+			return n;
+		}
+
+		std::size_t Capacity() const noexcept
+		{
+			std::size_t n = 0u;
+			for (auto page : _pages)
+				n += page != nullptr;
+			return n * PageSize;
+		}
+
+		//a shared page counts for every fork holding it
+		std::size_t Bytes() const noexcept
+		{
+			return Capacity() / PageSize * sizeof(Page) + _pages.capacity() * sizeof(Page*);
+		}
+	};
+
+	//two buffers, const access reads the previous frame and mutable access writes the next one
+	//so readers and the writer of a state can run together, States::Tick publishes next as previous
+	template<typename T>
+	class DoubleVec
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "DoubleVec copies whole buffers on swap!");
+		using buffer = uvector<T, std::pmr::polymorphic_allocator<T>>;
+		buffer _previous;
+		buffer _next;
+
+		void Resize(std::size_t sz)
+		{
+			if (sz > _next.size())
+			{
+				_previous.resize(sz);
+				_next.resize(sz);
+			}
+		}
+
+		static void PermuteBuffer(buffer& states, index_t begin, const std::vector<index_t>& order)
+		{
+			std::vector<T> temp(states.begin() + begin, states.begin() + begin + order.size());
+			for (index_t i = 0; i < order.size(); ++i)
+				states[begin + i] = temp[order[i] - begin];
+		}
+
+	public:
+		DoubleVec(std::size_t sz = 10u, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _previous(resource), _next(resource)
+		{
+			Resize(sz);
+		}
+
+		DoubleVec(const DoubleVec& other, const HBV::bit_vector& has, std::pmr::memory_resource* resource)
+			: _previous(other._previous, resource), _next(other._next, resource) {}
+
+		T &Get(index_t e)
+		{
+			return _next[e];
+		}
+
+		const T &Get(index_t e) const
+		{
+			return _previous[e];
+		}
+
+		void BatchCreate(index_t begin, index_t end, const T& arg)
+		{
+			Resize(end);
+			std::fill(&_previous[begin], &_previous[begin] + (end - begin), arg);
+			std::fill(&_next[begin], &_next[begin] + (end - begin), arg);
+		}
+
+		template<typename It>
+		void BatchCreateFrom(index_t begin, index_t end, It first)
+		{
+			Resize(end);
+			std::copy_n(first, end - begin, &_next[begin]);
+			memcpy(&_previous[begin], &_next[begin], (end - begin) * sizeof(T));
+		}
+
+		//a new state is visible in both frames
+		template<typename... Ts>
+		T &Emplace(index_t e, Ts&&... args)
+		{
+			Resize(e + 1u);
+			new(&_next[e]) T{ std::forward<Ts>(args)... };
+			_previous[e] = _next[e];
+			return _next[e];
+		}
+
+		T &Create(index_t e, const T& arg)
+		{
+			return Emplace(e, arg);
+		}
+
+		void Remove(index_t e) {}
+
+		void Permute(index_t begin, const std::vector<index_t>& order, const HBV::bit_vector& has)
+		{
+			Resize(begin + order.size());
+			PermuteBuffer(_previous, begin, order);
+			PermuteBuffer(_next, begin, order);
+		}
+
+		//next becomes previous, the new next starts from it
+		void Swap()
+		{
+			_previous.swap(_next);
+			memcpy(_next.data(), _previous.data(), _next.size() * sizeof(T));
+		}
+
+		//the writes of this frame are saved, a loaded state has them in both frames
+		void Save(SnapshotWriter& out) const
+		{
+			out.Write(uint64_t(_next.size()));
+			out.Align();
+			out.Write(_next.data(), _next.size() * sizeof(T));
+		}
+
+		void Load(SnapshotReader& in)
+		{
+			std::size_t size = in.Read<uint64_t>();
+			in.Align();
+			auto states = in.Read(size, sizeof(T));
+			_previous.resize(size);
+			_next.resize(size);
+			memcpy(_next.data(), states, size * sizeof(T));
+			memcpy(_previous.data(), states, size * sizeof(T));
+		}
+
+		std::size_t Capacity() const noexcept
+		{
+			return _next.capacity();
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return (_previous.capacity() + _next.capacity()) * sizeof(T);
+		}
+	};
+
+	//open addressing(robin hood) table, keys and values are stored flat
+	template<typename T>
+	class Hash
+	{
+		static constexpr index_t EmptyKey = std::numeric_limits<index_t>::max();
+		static constexpr index_t NotFound = std::numeric_limits<index_t>::max();
+		//max load factor is 7/8
+		static constexpr index_t LoadNum = 7u;
+		static constexpr index_t LoadDen = 8u;
+
+		std::pmr::memory_resource* _resource;
+		std::pmr::vector<index_t> _keys;
+		T* _values = nullptr;
+		index_t _size = 0u;
+		index_t _mask = 0u;
+		index_t _shift = 0u;
+
+		//fibonacci hashing, entity ids are sequential so we need to scatter them
+		index_t Home(index_t e) const noexcept
+		{
+			return index_t((uint64_t(e) * 0x9E3779B97F4A7C15ull) >> _shift) & _mask;
+		}
+
+		index_t Distance(index_t slot) const noexcept
+		{
+			return (slot - Home(_keys[slot])) & _mask;
+		}
+
+		index_t Find(index_t e) const noexcept
+		{
+			index_t slot = Home(e);
+			for (index_t dist = 0;; ++dist)
+			{
+				index_t key = _keys[slot];
+				if (key == e)
+					return slot;
+				//robin hood invariant: e would have been placed before a richer key
+				if (key == EmptyKey || Distance(slot) < dist)
+					return NotFound;
+				slot = (slot + 1) & _mask;
+			}
+		}
+
+		//e must not be in the table
+		index_t Insert(index_t e, T&& value)
+		{
+			if ((_size + 1) * LoadDen > _keys.size() * LoadNum)
+				Rehash(_keys.size() * 2u);
+			++_size;
+			index_t slot = Home(e);
+			index_t result = NotFound;
+			for (index_t dist = 0;; ++dist)
+			{
+				if (_keys[slot] == EmptyKey)
+				{
+					_keys[slot] = e;
+					new(&_values[slot]) T{ std::move(value) };
+					return result == NotFound ? slot : result;
+				}
+				index_t d = Distance(slot);
+				if (d < dist)
+				{
+					//steal the slot from the richer key and carry it on
+					std::swap(_keys[slot], e);
+					std::swap(_values[slot], value);
+					if (result == NotFound) result = slot;
+					dist = d;
+				}
+				slot = (slot + 1) & _mask;
+			}
+		}
+
+		//backward shift deletion, no tombstone
+		void Erase(index_t slot)
+		{
+			assert(slot != NotFound);
+			_values[slot].~T();
+			--_size;
+			index_t next = (slot + 1) & _mask;
+			while (_keys[next] != EmptyKey && Distance(next) > 0)
+			{
+				_keys[slot] = _keys[next];
+				new(&_values[slot]) T{ std::move(_values[next]) };
+				_values[next].~T();
+				slot = next;
+				next = (next + 1) & _mask;
+			}
+			_keys[slot] = EmptyKey;
+		}
+
+		void Allocate(index_t capacity)
+		{
+			_keys.clear();
+			_keys.resize(capacity, EmptyKey);
+			_values = (T*)_resource->allocate(sizeof(T)*capacity, alignof(T));
+			_mask = capacity - 1;
+			_shift = 64u - HBV::lowbit_pos(capacity);
+			_size = 0u;
+		}
+
+		void Release()
+		{
+			if constexpr(!std::is_pod_v<T>)
+			{
+				for (index_t i = 0; i < _keys.size(); ++i)
+					if (_keys[i] != EmptyKey)
+						_values[i].~T();
+			}
+			_resource->deallocate(_values, sizeof(T)*_keys.size(), alignof(T));
+			_values = nullptr;
 		}
 
-		const T &Get(index_t e) const
+		void Rehash(index_t capacity)
 		{
-			return *(T*)nullptr;
+			std::pmr::vector<index_t> keys{ _resource };
+			keys.swap(_keys);
+			T* values = _values;
+			Allocate(capacity);
+			for (index_t i = 0; i < keys.size(); ++i)
+				if (keys[i] != EmptyKey)
+				{
+					Insert(keys[i], std::move(values[i]));
+					values[i].~T();
+				}
+			_resource->deallocate(values, sizeof(T)*keys.size(), alignof(T));
 		}
 
-		void BatchCreate(index_t begin, index_t end, const T& arg)
+		static index_t CapacityFor(std::size_t n)
 		{
+			index_t capacity = 16u;
+			while (capacity * LoadNum < n * LoadDen)
+				capacity *= 2u;
+			return capacity;
 		}
 
-		T &Create(index_t e, const T& arg)
+	public:
+		Hash(std::size_t sz = 10u, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _resource(resource), _keys(resource)
 		{
-			return *(T*)nullptr;
+			Allocate(CapacityFor(sz));
 		}
 
-		void BatchRemove(const bit_vector_and2& remove)
-		{
-		}
+		Hash(const Hash& other)
+			: Hash(other, other._resource) {}
 
-		void Remove(index_t e)
+		Hash(const Hash& other, const HBV::bit_vector& has, std::pmr::memory_resource* resource)
+			: Hash(other, resource) {}
+
+		Hash(const Hash& other, std::pmr::memory_resource* resource)
+			: _resource(resource), _keys(resource)
 		{
+			Allocate(other._keys.size());
+			for (index_t i = 0; i < other._keys.size(); ++i)
+				if (other._keys[i] != EmptyKey)
+				{
+					_keys[i] = other._keys[i];
+					new(&_values[i]) T{ other._values[i] };
+				}
+			_size = other._size;
 		}
-	};
 
-	template<typename T, Trace... types>
-	class EntityState<Placeholder<T>, types...> : public EntityStateGeneric<Placeholder<T>, types...>
-	{
-		using Generic = EntityStateGeneric<Placeholder<T>, types...>;
-	public:
-		EntityState() :Generic() {}
+		Hash& operator=(const Hash&) = delete;
 
-		auto &Get(index_t e) noexcept
+		~Hash()
 		{
-			static_assert(false, "don't get from placeholder");
-			return _container.Get(e);
+			Release();
 		}
 
-		const auto &Get(index_t e) const noexcept
+		index_t Size() const noexcept
 		{
-			static_assert(false, "don't get from placeholder");
-			return _container.Get(e);
+			return _size;
 		}
-	};
 
-	template<typename T>
-	class Vec
-	{
-		uvector<T> _states;
-	public:
+		void Clear()
+		{
+			if (_size == 0u)
+				return;
+			Release();
+			std::pmr::vector<index_t>{ _resource }.swap(_keys);
+			Allocate(CapacityFor(10u));
+		}
 
-		Vec(std::size_t sz = 10u) 
+		void Reserve(std::size_t n)
 		{
-			_states.resize(sz);
+			index_t capacity = CapacityFor(n);
+			if (capacity > _keys.size())
+				Rehash(capacity);
 		}
+
 		T &Get(index_t e)
 		{
-			return _states[e];
+			index_t slot = Find(e);
+			assert(slot != NotFound);
+			return _values[slot];
 		}
 
 		const T &Get(index_t e) const
 		{
-			return _states[e];
+			index_t slot = Find(e);
+			assert(slot != NotFound);
+			return _values[slot];
 		}
 
-		void BatchCreate(index_t begin, index_t end, const T& arg)
+		template<typename... Ts>
+		T &Emplace(index_t e, Ts&&... args)
 		{
-			_states.resize(end);
-			for (auto i = begin; i < end; ++i)
-				new(&_states[i]) T{ arg };
+			index_t slot = Find(e);
+			if (slot != NotFound)
+			{
+				_values[slot].~T();
+				return *(new(&_values[slot]) T{ std::forward<Ts>(args)... });
+			}
+			return _values[Insert(e, T{ std::forward<Ts>(args)... })];
 		}
 
 		T &Create(index_t e, const T& arg)
 		{
-			if (e >= _states.size())
-			{
-				_states.resize(e + 1u);
-				return *(new(&_states[e]) T{ arg });
-			}
-			
-			return *(new(&_states[e]) T{ arg });
+			return Emplace(e, arg);
 		}
 
-		void BatchRemove(const bit_vector_and2& remove)
+		void BatchCreate(index_t begin, index_t end, const T& arg)
 		{
-			if constexpr(!std::is_pod_v<T>)
-			{
-				HBV::for_each(remove, [this](index_t i)
-				{
-					_states[i].~T();
-				});
-			}
+			//grow once for the whole batch
+			Reserve(_size + (end - begin));
+			for (index_t i = begin; i < end; ++i)
+				Create(i, arg);
 		}
 
 		void Remove(index_t e)
 		{
-			if constexpr(!std::is_pod_v<T>)
-				_states[e].~T();
+			Erase(Find(e));
 		}
-	};
 
-	template<typename T>
-	class Hash
-	{
-		std::unordered_map<index_t, T> _states;
-	public:
-		Hash(std::size_t sz = 10u)
-		{
-			_states.reserve(sz);
-		}
-		T &Get(index_t e)
-		{
-			return _states.at(e);
-		}
-		const T &Get(index_t e) const
+		void BatchRemove(const bit_vector_and2& remove)
 		{
-			return _states.at(e);
+			HBV::for_each(remove, [this](index_t i)
+			{
+				Erase(Find(i));
+			});
 		}
 
-		T &Create(index_t e, const T& arg)
+		//values held before the next rehash
+		std::size_t Capacity() const noexcept
 		{
-			return _states.insert_or_assign(e, T{ arg }).first->second;
+			return _keys.size() * LoadNum / LoadDen;
 		}
 
-		void Remove(index_t e)
+		std::size_t Bytes() const noexcept
 		{
-			_states.erase(e);
+			return _keys.capacity() * sizeof(index_t) + (_values != nullptr ? _keys.size() * sizeof(T) : 0u);
 		}
 	};
 
@@ -367,13 +1580,42 @@ namespace ESL
 	class SparseVec
 	{
 		const HBV::bit_vector& _entity;
-		lni::vector<T*> _states;
+		std::pmr::memory_resource* _resource;
+		std::pmr::vector<T*> _states;
 		static constexpr index_t Level = 2u;
 		static constexpr index_t BucketSize = 1 << ((HBV::LayerCount - Level)*HBV::BitsPerLayer);
 
+		void AddBucket(index_t bucket)
+		{
+			_states[bucket] = (T*)_resource->allocate(sizeof(T)*BucketSize, alignof(T));
+		}
+
+		void EraseBucket(index_t bucket)
+		{
+			_resource->deallocate(_states[bucket], sizeof(T)*BucketSize, alignof(T));
+			_states[bucket] = nullptr;
+		}
+
 	public:
-		SparseVec(const HBV::bit_vector& entities) 
-			: _entity(entities), _states(10u, nullptr) {}
+		SparseVec(const HBV::bit_vector& entities, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) 
+			: _entity(entities), _resource(resource), _states(10u, nullptr, resource) {}
+
+		SparseVec(const SparseVec&) = delete;
+		SparseVec& operator=(const SparseVec&) = delete;
+
+		~SparseVec()
+		{
+			if constexpr(!std::is_pod_v<T>)
+			{
+				HBV::for_each(_entity, [this](index_t i)
+				{
+					_states[i / BucketSize][i % BucketSize].~T();
+				});
+			}
+			for (index_t i = 0; i < _states.size(); ++i)
+				if (_states[i])
+					EraseBucket(i);
+		}
 
 		T & Get(index_t e)
 		{
@@ -389,15 +1631,21 @@ namespace ESL
 			return _states[bucket][index];
 		}
 
-		T &Create(index_t e, const T& arg)
+		template<typename... Ts>
+		T &Emplace(index_t e, Ts&&... args)
 		{
 			index_t bucket = e / BucketSize;
 			if (_states.size() <= bucket)
 				_states.resize(bucket + _states.size(), nullptr);
 			if (_states[bucket] == nullptr)
-				_states[bucket] = (T*)malloc(sizeof(T)*BucketSize);
+				AddBucket(bucket);
 			index_t index = e % BucketSize;
-			return *(new (_states[bucket] + index) T{ arg });
+			return *(new (_states[bucket] + index) T{ std::forward<Ts>(args)... });
+		}
+
+		T &Create(index_t e, const T& arg)
+		{
+			return Emplace(e, arg);
 		}
 
 		void BatchCreate(index_t begin, index_t end, const T& arg)
@@ -408,23 +1656,21 @@ namespace ESL
 				_states.resize(last + _states.size(), nullptr);
 			for (index_t i = first; i <= last; ++i)
 				if (_entity.layer(Level, i) && !_states[i])
-					_states[i] = (T*)malloc(sizeof(T)*BucketSize);
-			if constexpr(std::is_pod_v<T>)
-			{
-				for (index_t i = first + 1; i < last; ++i)
-					std::fill_n(_states[i], BucketSize, arg);
-				index_t firstIndex = begin % BucketSize;
-				std::fill_n(_states[first] + firstIndex, BucketSize - firstIndex, arg);
-				std::fill_n(_states[last], (end - 1) % BucketSize + 1, arg);
-			}
-			else
+					AddBucket(i);
+			//fill bucket by bucket, first and last bucket may be partial
+			for (index_t i = begin; i < end;)
 			{
-				for (index_t i = begin; i < end; ++i)
+				index_t bucket = i / BucketSize;
+				index_t index = i % BucketSize;
+				index_t n = std::min(end - i, BucketSize - index);
+				if constexpr(std::is_pod_v<T>)
+					std::fill_n(_states[bucket] + index, n, arg);
+				else
 				{
-					index_t bucket = e / BucketSize;
-					index_t index = e % BucketSize;
-					new (_states[bucket] + index) T{ arg };
+					for (index_t j = index; j < index + n; ++j)
+						new (_states[bucket] + j) T{ arg };
 				}
+				i += n;
 			}
 		}
 
@@ -437,7 +1683,7 @@ namespace ESL
 				_states[bucket][index].~T();
 			}
 			if (!_entity.layer(Level, bucket) && _states[bucket])
-				free(_states[bucket]);
+				EraseBucket(bucket);
 		}
 
 		void BatchRemove(const bit_vector_and2& remove)
@@ -446,20 +1692,33 @@ namespace ESL
 			{
 				HBV::for_each(remove, [this](index_t i)
 				{
-					index_t bucket = e / BucketSize;
-					index_t index = e % BucketSize;
+					index_t bucket = i / BucketSize;
+					index_t index = i % BucketSize;
 					_states[bucket][index].~T();
 				});
 			}
 		}
 
+		//release buckets emptied by the batch
 		void AfterBatchRemove()
 		{
-			HBV::for_each<Level - 1>(_entity, [this](index_t i)
-			{
-				if (!_entity.layer(Level, i) && _states[i])
-					free(_states[i]);
-			});
+			index_t buckets = std::min<index_t>(_states.size(), (_entity.size() - 1) / BucketSize + 1);
+			for (index_t i = 0; i < buckets; ++i)
+				if (_states[i] && !_entity.layer(Level, i))
+					EraseBucket(i);
+		}
+
+		std::size_t Capacity() const noexcept
+		{
+			std::size_t n = 0u;
+			for (auto bucket : _states)
+				n += bucket != nullptr;
+			return n * BucketSize;
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return Capacity() * sizeof(T) + _states.capacity() * sizeof(T*);
 		}
 	};
 
@@ -469,7 +1728,8 @@ namespace ESL
 		using Generic = EntityStateGeneric<SparseVec<T>, types...>;
 
 	public:
-		EntityState() noexcept : Generic((const HBV::bit_vector&)_entity) {}
+		EntityState(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: Generic(resource, (const HBV::bit_vector&)_entity) {}
 
 	protected:
 
@@ -483,7 +1743,7 @@ namespace ESL
 	template<typename T>
 	class DenseVec
 	{
-		uvector<T> _states;
+		uvector<T, std::pmr::polymorphic_allocator<T>> _states;
 		HBV::bit_vector _empty;
 		SparseVec<index_t> _redirector;
 		auto GetFree()
@@ -494,8 +1754,8 @@ namespace ESL
 			return id;
 		}
 	public:
-		DenseVec(const HBV::bit_vector& entities)
-			: _redirector(entities), _empty(10u, true) 
+		DenseVec(const HBV::bit_vector& entities, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _states(resource), _empty(10u, true, resource), _redirector(entities, resource)
 		{
 			_states.resize(10u);
 		}
@@ -510,7 +1770,8 @@ namespace ESL
 			return _states[_redirector.Get(e)];
 		}
 
-		T &Create(index_t e, const T& arg)
+		template<typename... Ts>
+		T &Emplace(index_t e, Ts&&... args)
 		{
 			auto free = GetFree();
 			while (!free.has_value() || free.value() >= _states.size())
@@ -521,7 +1782,12 @@ namespace ESL
 			}
 			_empty.set(free.value(), false);
 			_redirector.Create(e, free.value());
-			return *(new(&_states[free.value()]) T{ arg });
+			return *(new(&_states[free.value()]) T{ std::forward<Ts>(args)... });
+		}
+
+		T &Create(index_t e, const T& arg)
+		{
+			return Emplace(e, arg);
 		}
 
 		void Remove(index_t e)
@@ -531,6 +1797,16 @@ namespace ESL
 			_empty.set(_redirector.Get(e), true);
 			_redirector.Remove(e);
 		}
+
+		std::size_t Capacity() const noexcept
+		{
+			return _states.capacity();
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return _states.capacity() * sizeof(T) + BitVectorBytes(_empty) + _redirector.Bytes();
+		}
 	};
 
 	template<typename T, Trace... types>
@@ -538,7 +1814,47 @@ namespace ESL
 	{
 		using Generic = EntityStateGeneric<DenseVec<T>, types...>;
 	public:
-		EntityState() noexcept : Generic((const HBV::bit_vector&)_entity) {}
+		EntityState(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: Generic(resource, (const HBV::bit_vector&)_entity) {}
+	};
+
+	template<typename T>
+	using SupportStdHash = decltype(std::hash<T>{}(std::declval<const T&>()));
+
+	template<typename T>
+	using SupportEqual = decltype(std::declval<const T&>() == std::declval<const T&>());
+
+	//how UniqueVec interns values, specialize it for types without std::hash or operator==
+	//the byte wise fallback needs every byte to be part of the value, padding and floats are not
+	template<typename T>
+	struct UniqueTrait
+	{
+		static std::size_t Hash(const T& value) noexcept
+		{
+			if constexpr(MPL::is_detected<SupportStdHash, T>{})
+				return std::hash<T>{}(value);
+			else
+			{
+				static_assert(std::has_unique_object_representations_v<T>, "T has padding or floats, specialize UniqueTrait for it!");
+				//FNV-1a over the object bytes
+				std::size_t hash = 14695981039346656037ull;
+				auto bytes = reinterpret_cast<const unsigned char*>(&value);
+				for (std::size_t i = 0; i < sizeof(T); ++i)
+					hash = (hash ^ bytes[i]) * 1099511628211ull;
+				return hash;
+			}
+		}
+
+		static bool Equal(const T& a, const T& b) noexcept
+		{
+			if constexpr(MPL::is_detected<SupportEqual, T>{})
+				return a == b;
+			else
+			{
+				static_assert(std::has_unique_object_representations_v<T>, "T has padding or floats, specialize UniqueTrait for it!");
+				return memcmp(&a, &b, sizeof(T)) == 0;
+			}
+		}
 	};
 
 	template<typename T>
@@ -548,41 +1864,117 @@ namespace ESL
 		{
 			T* state{nullptr};
 			index_t refCount;
-			HBV::bit_vector entities{10u};
+			std::size_t hash;
+			HBV::bit_vector entities;
+
+			Unique(std::pmr::memory_resource* resource) : entities(10u, false, resource) {}
 		};
-		lni::vector<Unique> _states;
+		std::pmr::memory_resource* _resource;
+		std::pmr::vector<Unique> _states;
+		//content hash -> unique slot
+		std::pmr::unordered_multimap<std::size_t, index_t> _index;
+		std::pmr::vector<index_t> _free;
 		SparseVec<index_t> _redirector;
 		
-		void CreateOn(index_t e, index_t i) noexcept
+		void CreateOn(index_t e, index_t i)
 		{
 			auto& entities = _states[i].entities;
-			if (entities.size() < e)
-				entities.grow_to(e * 3 / 2);
+			if (entities.size() <= e)
+				entities.grow_to(e * 3 / 2 + 1);
 			entities.set(e, true);
 			_redirector.Create(e, i);
 		}
+
+		int32_t Lookup(const T& arg, std::size_t hash) const
+		{
+			auto range = _index.equal_range(hash);
+			for (auto it = range.first; it != range.second; ++it)
+				if (UniqueTrait<T>::Equal(*_states[it->second].state, arg))
+					return it->second;
+			return -1;
+		}
+
+		//find the slot holding an equal value or copy arg into a new one
+		index_t Intern(const T& arg)
+		{
+			std::size_t hash = UniqueTrait<T>::Hash(arg);
+			int32_t found = Lookup(arg, hash);
+			if (found >= 0)
+				return found;
+			index_t i;
+			if (!_free.empty())
+			{
+				i = _free.back();
+				_free.pop_back();
+			}
+			else
+			{
+				i = _states.size();
+				_states.emplace_back(_resource);
+			}
+			auto& unique = _states[i];
+			unique.state = new(_resource->allocate(sizeof(T), alignof(T))) T{ arg };
+			unique.refCount = 0;
+			unique.hash = hash;
+			_index.emplace(hash, i);
+			return i;
+		}
+
+		void Release(index_t i)
+		{
+			auto& unique = _states[i];
+			auto range = _index.equal_range(unique.hash);
+			for (auto it = range.first; it != range.second; ++it)
+				if (it->second == i)
+				{
+					_index.erase(it);
+					break;
+				}
+			unique.entities.clear();
+			unique.state->~T();
+			_resource->deallocate(unique.state, sizeof(T), alignof(T));
+			unique.state = nullptr;
+			_free.push_back(i);
+		}
 	public:
-		UniqueVec(const HBV::bit_vector& entities)
-			: _redirector(entities), FilterId(-1) {}
+		UniqueVec(const HBV::bit_vector& entities, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _resource(resource), _states(resource), _index(resource), _free(resource), 
+			_redirector(entities, resource), FilterId(-1) {}
+
+		UniqueVec(const UniqueVec&) = delete;
+		UniqueVec& operator=(const UniqueVec&) = delete;
+
+		~UniqueVec()
+		{
+			for (auto& unique : _states)
+				if (unique.state != nullptr)
+				{
+					unique.state->~T();
+					_resource->deallocate(unique.state, sizeof(T), alignof(T));
+				}
+		}
 		const T &Get(index_t e) const
 		{
-			if(FilterId>0)
+			if(FilterId >= 0)
 				return *(_states[FilterId].state);
 			else
 				return *(_states[_redirector.Get(e)].state);
 		}
 
+		//NOTE: released slots are counted too, check them with HasUnique
 		index_t UniqueSize() const
 		{
 			return _states.size();
 		}
 
+		bool HasUnique(index_t i) const
+		{
+			return _states[i].state != nullptr;
+		}
+
 		int32_t FindUnique(const T& arg) const
 		{
-			for (index_t i = 0; i < _states.size(); ++i)
-				if (&arg == _states[i].state)
-					return i;
-			return -1;
+			return Lookup(arg, UniqueTrait<T>::Hash(arg));
 		}
 
 		int32_t FilterId;
@@ -594,58 +1986,57 @@ namespace ESL
 
 		void BatchCreate(index_t begin, index_t end, const T& arg)
 		{
-			Create(begin, arg);
-			index_t prototype = _redirector.Get(begin);
+			if (begin == end)
+				return;
+			index_t prototype = Intern(arg);
 			auto& unique = _states[prototype];
 			unique.refCount += end - begin;
 			if (unique.entities.size() < end)
 				unique.entities.grow_to(end + 1u);
-			unique.entities.set_range(begin + 1, end, true);
-			_redirector.BatchCreate(begin + 1, end, prototype);
+			unique.entities.set_range(begin, end, true);
+			_redirector.BatchCreate(begin, end, prototype);
 		}
 
 		void Instantiate(index_t e, index_t proto)
 		{
 			index_t prototype = _redirector.Get(proto);
 			_states[prototype].refCount++;
-			_redirector.Create(e, prototype);
+			CreateOn(e, prototype);
 		}
 
-		//Hack!ǿȡargȨ
+		//arg is copied, equal values share one slot
 		const T &Create(index_t e, const T& arg)
 		{
-			for (index_t i = 0; i < _states.size(); ++i)
-				if (&arg == _states[i].state)
-				{
-					CreateOn(e, i);
-					_states[i].refCount++;
-					return arg;
-				}
-			index_t i = 0;
-			for (; i < _states.size(); ++i)
-				if (nullptr == _states[i].state) break;
-			if(i == _states.size()) _states.emplace_back();
+			index_t i = Intern(arg);
 			CreateOn(e, i);
-			_states[i].refCount = 1;
-			_states[i].state = const_cast<T*>(&arg);
-			return arg;
+			_states[i].refCount++;
+			return *_states[i].state;
 		}
 
 		void Remove(index_t e)
 		{
-			auto& unique = _states[_redirector.Get(e)];
-			if (--unique.refCount == 0)
-			{
-				unique.entities.clear();
-				delete unique.state;
-				unique.state = nullptr;
-				_redirector.Remove(e);
-			}
+			index_t i = _redirector.Get(e);
+			_redirector.Remove(e);
+			if (--_states[i].refCount == 0)
+				Release(i);
 			else
-			{
-				unique.entities.set(e, false);
-				_redirector.Remove(e);
-			}
+				_states[i].entities.set(e, false);
+		}
+
+		//distinct values the slot table has room for
+		std::size_t Capacity() const noexcept
+		{
+			return _states.capacity();
+		}
+
+		//nodes of the index are estimated, the standard doesn't expose them
+		std::size_t Bytes() const noexcept
+		{
+			std::size_t bytes = _states.capacity() * sizeof(Unique) + _free.capacity() * sizeof(index_t) + _redirector.Bytes();
+			for (auto& unique : _states)
+				bytes += (unique.state != nullptr ? sizeof(T) : 0u) + BitVectorBytes(unique.entities);
+			bytes += _index.bucket_count() * sizeof(void*) + _index.size() * (sizeof(std::pair<std::size_t, index_t>) + 2 * sizeof(void*));
+			return bytes;
 		}
 	};
 
@@ -654,17 +2045,23 @@ namespace ESL
 	{
 		using Generic = EntityStateGeneric<UniqueVec<T>, types...>;
 	public:
-		EntityState() noexcept : Generic((const HBV::bit_vector&)_entity) {}
+		EntityState(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: Generic(resource, (const HBV::bit_vector&)_entity) {}
 
 		index_t UniqueSize() const noexcept
 		{
 			return _container.UniqueSize();
 		}
 
+		bool HasUnique(index_t i) const noexcept
+		{
+			return _container.HasUnique(i);
+		}
+
 		void UniqueAsFilter(const T& value) noexcept
 		{
 			int32_t id = _container.FindUnique(value);
-			assert(id > 0);
+			assert(id >= 0);
 			_container.FilterId = id;
 		}
 
@@ -701,86 +2098,216 @@ namespace ESL
 	template<typename T>
 	class SharedVec
 	{
-		uvector<T> _states;
-		HBV::bit_vector _empty;
-		uvector<index_t> _refs;
+		//slots live in chunks of geometric size, chunks never move so a clone
+		//can be made while other threads hold references
+		static constexpr index_t BaseBits = 4u;
+		static constexpr index_t MaxChunks = 32u - BaseBits;
+
+		struct Slot
+		{
+			std::aligned_storage_t<sizeof(T), alignof(T)> value;
+			std::atomic<index_t> refs;
+		};
+
+		const HBV::bit_vector& _entity;
+		std::pmr::memory_resource* _resource;
+		std::array<Slot*, MaxChunks> _chunks{};
+		index_t _capacity = 0u;
+		index_t _size = 0u;
+		std::pmr::vector<index_t> _free;
 		SparseVec<index_t> _redirector;
-		auto GetFree()
+		SpinLock _lock;
+
+		Slot &At(index_t id) const noexcept
 		{
-			std::optional<index_t> id{};
-			if(!_empty.empty())
-				id = HBV::first(_empty);
-			return id;
+			index_t v = id + (1u << BaseBits);
+			index_t high = HBV::highbit_pos(v);
+			return _chunks[high - BaseBits][v - (1u << high)];
 		}
 
-		index_t CreateFree(index_t e)
+		T &Value(index_t id) const noexcept
 		{
-			auto free = GetFree();
-			while (!free.has_value() || free.value() >= _states.size())
+			return *reinterpret_cast<T*>(&At(id).value);
+		}
+
+		//make sure slots [0, n) are backed, caller holds the lock
+		void Reserve(index_t n)
+		{
+			while (_capacity < n)
 			{
-				_states.resize(_states.size() + 10u);
-				_refs.resize(_states.size() + 10u);
-				_empty.grow_to(_states.size(), true);
-				free = GetFree();
+				index_t chunk = HBV::highbit_pos(_capacity + (1u << BaseBits)) - BaseBits;
+				index_t size = 1u << (chunk + BaseBits);
+				_chunks[chunk] = (Slot*)_resource->allocate(sizeof(Slot)*size, alignof(Slot));
+				for (index_t i = 0; i < size; ++i)
+					new(&_chunks[chunk][i].refs) std::atomic<index_t>{ 0u };
+				_capacity += size;
 			}
-			_empty.set(free.value(), false);
-			_refs[free.value()] = 1;
-			_redirector.Create(e, free.value());
-			return free.value();
+		}
+
+		index_t Allocate()
+		{
+			std::lock_guard<SpinLock> guard{ _lock };
+			if (!_free.empty())
+			{
+				index_t id = _free.back();
+				_free.pop_back();
+				return id;
+			}
+			Reserve(_size + 1);
+			return _size++;
+		}
+
+		void Free(index_t id)
+		{
+			std::lock_guard<SpinLock> guard{ _lock };
+			_free.push_back(id);
+		}
+
+		//drop one reference, the last one destroys the value
+		void Release(index_t id)
+		{
+			if (At(id).refs.fetch_sub(1u, std::memory_order_acq_rel) == 1u)
+			{
+				if constexpr(!std::is_pod_v<T>)
+					Value(id).~T();
+				Free(id);
+			}
+		}
+
+		index_t CreateFree(index_t e, const T& arg)
+		{
+			index_t id = Allocate();
+			new(&Value(id)) T{ arg };
+			At(id).refs.store(1u, std::memory_order_relaxed);
+			_redirector.Create(e, id);
+			return id;
 		}
 
 	public:
-		SharedVec(const HBV::bit_vector& entities)
-			: _redirector(entities), _empty(10u, true)
+		SharedVec(const HBV::bit_vector& entities, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: _entity(entities), _resource(resource), _free(resource), _redirector(entities, resource) {}
+
+		SharedVec(const SharedVec&) = delete;
+		SharedVec& operator=(const SharedVec&) = delete;
+
+		//free and reserved slots have no references, every other slot holds a value
+		~SharedVec()
 		{
-			_states.resize(10u);
-			_refs.resize(10u);
+			if constexpr(!std::is_pod_v<T>)
+				for (index_t i = 0; i < _size; ++i)
+					if (At(i).refs.load(std::memory_order_relaxed) != 0u)
+						Value(i).~T();
+			for (index_t chunk = 0; chunk < MaxChunks && _chunks[chunk] != nullptr; ++chunk)
+				_resource->deallocate(_chunks[chunk], sizeof(Slot)*(1u << (chunk + BaseBits)), alignof(Slot));
 		}
 
+		//copy on write, safe to call for different entities concurrently
 		T & Get(index_t e)
 		{
-			index_t id = _redirector.Get(e);
-			if (_refs[id] > 1)
+			index_t& id = _redirector.Get(e);
+			if (At(id).refs.load(std::memory_order_acquire) > 1u)
 			{
-				_refs[id]--;
-				return *(new(&_states[CreateFree(e)]) T{ _states[id] });
+				index_t shared = id;
+				index_t clone = Allocate();
+				new(&Value(clone)) T{ Value(shared) };
+				At(clone).refs.store(1u, std::memory_order_relaxed);
+				id = clone;
+				Release(shared);
 			}
-			return _states[id];
+			return Value(id);
 		}
 
 		const T &Get(index_t e) const
 		{
-			return _states[_redirector.Get(e)];
+			return Value(_redirector.Get(e));
+		}
+
+		index_t Refs(index_t e) const
+		{
+			return At(_redirector.Get(e)).refs.load(std::memory_order_relaxed);
+		}
+
+		//reserve n continuous slots for UnshareTo, returns the first one
+		index_t ReserveSlots(index_t n)
+		{
+			std::lock_guard<SpinLock> guard{ _lock };
+			Reserve(_size + n);
+			index_t base = _size;
+			_size += n;
+			return base;
+		}
+
+		//give e a private copy in a reserved slot if it is still shared
+		void UnshareTo(index_t e, index_t slot)
+		{
+			if (!_entity.contain(e))
+				return;
+			index_t& id = _redirector.Get(e);
+			if (At(id).refs.load(std::memory_order_acquire) <= 1u)
+				return;
+			index_t shared = id;
+			new(&Value(slot)) T{ Value(shared) };
+			At(slot).refs.store(1u, std::memory_order_relaxed);
+			id = slot;
+			Release(shared);
+		}
+
+		//return reserved slots that UnshareTo didn't use
+		void ReleaseSlots(index_t base, index_t n)
+		{
+			std::lock_guard<SpinLock> guard{ _lock };
+			for (index_t i = base; i < base + n; ++i)
+				if (At(i).refs.load(std::memory_order_relaxed) == 0u)
+					_free.push_back(i);
+		}
+
+		//clone the shared value for every entity in [begin, end) at once
+		void BatchUnshare(index_t begin, index_t end)
+		{
+			index_t base = ReserveSlots(end - begin);
+			for (index_t i = begin; i < end; ++i)
+				UnshareTo(i, base + i - begin);
+			ReleaseSlots(base, end - begin);
 		}
 
 		void BatchCreate(index_t begin, index_t end, const T& arg)
 		{
-			Create(begin, arg);
-			index_t prototype = _redirector.Get(begin);
-			_refs[prototype] = end - begin;
+			//an empty range would keep a value nobody refers to
+			if (begin == end)
+				return;
+			index_t prototype = CreateFree(begin, arg);
+			At(prototype).refs.store(end - begin, std::memory_order_relaxed);
 			_redirector.BatchCreate(begin + 1, end, prototype);
 		}
 
 		void Instantiate(index_t e, index_t proto)
 		{
 			index_t prototype = _redirector.Get(proto);
-			_refs[prototype]++;
+			At(prototype).refs.fetch_add(1u, std::memory_order_relaxed);
 			_redirector.Create(e, prototype);
 		}
 
 		T &Create(index_t e, const T& arg)
 		{
-			return *(new(&_states[CreateFree(e)]) T{ arg });
+			return Value(CreateFree(e, arg));
 		}
 
 		void Remove(index_t e)
 		{
-			if constexpr(!std::is_pod_v<T>)
-				_states[_redirector.Get(e)].~T();
-			_refs[_redirector.Get(e)]--;
-			_empty.set(_redirector.Get(e), true);
+			Release(_redirector.Get(e));
 			_redirector.Remove(e);
 		}
+
+		//slots in the chunks, shared values take one slot for all their entities
+		std::size_t Capacity() const noexcept
+		{
+			return _capacity;
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return _capacity * sizeof(Slot) + _free.capacity() * sizeof(index_t) + _redirector.Bytes();
+		}
 	};
 
 	template<typename T, Trace... types>
@@ -788,6 +2315,12 @@ namespace ESL
 	{
 		using Generic = EntityStateGeneric<SharedVec<T>, types...>;
 	public:
-		EntityState() noexcept : Generic((const HBV::bit_vector&)_entity) {}
+		EntityState(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+			: Generic(resource, (const HBV::bit_vector&)_entity) {}
+
+		void BatchUnshare(index_t begin, index_t end)
+		{
+			_container.BatchUnshare(begin, end);
+		}
 	};
 }
@@ -14,7 +14,10 @@ namespace ESL
 			template<typename T, typename S, typename A>
 			static decltype(auto) Take(S &states, index_t id, A &datas, std::true_type)
 			{
-				return std::get<T*>(datas)[id];
+				if constexpr(IsRawTagState<T>{})
+					return T{};
+				else
+					return std::get<T*>(datas)[id];
 			}
 
 			template<typename T, typename S, typename A>
@@ -66,7 +69,8 @@ namespace ESL
 		typename Dispatcher::CheckFilters<ExplictFilters>::type checker; (void)checker;
 		using Filters = typename Dispatcher::FixFilters<ExplictFilters, ImplictFilters>::type;
 		
-		using PerEntityData = MPL::concat_t<MPL::typelist<Entity>, RawEntityStates>;
+		using ValueStates = MPL::filter_t<IsRawValueState, RawEntityStates>;
+		using PerEntityData = MPL::concat_t<MPL::typelist<Entity>, ValueStates>;
 		static_assert(MPL::size<Filters>{} != 0 || MPL::contain_v<Entity, DecayArgument>, "wrong parameter!");
 		
 		const auto available = MPL::rewrap_t<Dispatcher::ComposeHelper, Filters>::ComposeBitVector(states);
@@ -84,10 +88,10 @@ namespace ESL
 			using type = std::remove_pointer_t<std::remove_reference_t<decltype(point)>>;
 			if constexpr(!std::is_same_v<type, Entity>)
 			{
-				auto state = MPL::nonstrict_get<const State<type>&>(states);
+				auto& state = MPL::nonstrict_get<const State<type>&>(states);
 				point = (type*)malloc(sizeof(type)*size); //
 				for (int i = 0; i < size; ++i)
-					point[i] = state.Get(indexArray[i]); //ȡ,
+					point[i] = std::as_const(state).Get(indexArray[i]); //ȡ,
 			}
 			else
 			{
@@ -107,12 +111,13 @@ namespace ESL
 			if constexpr(!std::is_same_v<type, Entity>)
 				if constexpr(MPL::contain_v<State<type>&, MPL::rewrap_t<MPL::typelist, S>>)
 				{
-					auto state = std::get<State<type>&>(states);
+					auto& state = std::get<State<type>&>(states);
 					for (int i = 0; i < size; ++i)
-						state.Get(indexArray[i]) = point[i]; //дطconst
+						state.GetUntraced(indexArray[i]) = point[i]; //дطconst
 				}
 			free(point);
 		});
+		MPL::rewrap_t<Dispatcher::BorrowHelper, ValueStates>::Mark(states, available);
 	}
 
 	template<typename F>
@@ -1,4 +1,9 @@
 #pragma once
+#include <functional>
+#include <mutex>
+#include <cassert>
+#include <tbb\tbb.h>
+#include "MPL.h"
 
 namespace ESL
 {
@@ -20,5 +25,73 @@ namespace ESL
 			return _singleton;
 		}
 	};
-}
 
+	template<typename T>
+	using SupportAddAssign = decltype(std::declval<T&>() += std::declval<const T&>());
+
+	//global state reduced in parallel, writers get a per worker copy and readers the combined value
+	//a system taking T& writes its worker's copy, one taking const T& reads the combined value
+	//a LogicGraph combines before a node reading it runs, elsewhere call Combine() before reading
+	template<typename T>
+	class CombinableState
+	{
+		using CombineFunc = std::function<void(T&, const T&)>;
+		T _identity;
+		//folded lazily by readers, which never run with a writer
+		mutable T _value;
+		mutable tbb::enumerable_thread_specific<T> _locals;
+		mutable std::mutex _lock;
+		CombineFunc _combine;
+
+		static CombineFunc DefaultCombine()
+		{
+			return [](T& to, const T& from)
+			{
+				if constexpr(MPL::is_detected<SupportAddAssign, T>{})
+					to += from;
+				else
+					assert(false && "no combine step for the state");
+			};
+		}
+
+	public:
+		CombinableState(T identity = T{}, CombineFunc combine = DefaultCombine())
+			: _identity(identity), _value(identity), _locals(identity), _combine(std::move(combine)) {}
+
+		//a fork starts from the combined value with its own lock and no worker copies
+		CombinableState(const CombinableState& other)
+			: _identity(other._identity), _value((other.Combine(), other._value)), _locals(other._identity), _combine(other._combine) {}
+
+		T& Raw()
+		{
+			return _locals.local();
+		}
+
+		const T& Raw() const
+		{
+			return _value;
+		}
+
+		//fold the worker copies into the value, they start from identity again
+		//readers may call it concurrently, the first one folds
+		void Combine() const
+		{
+			std::lock_guard<std::mutex> guard{ _lock };
+			for (auto& local : _locals)
+				_combine(_value, local);
+			_locals.clear();
+		}
+
+		void Reset()
+		{
+			_value = _identity;
+			_locals.clear();
+		}
+	};
+
+	template<typename T>
+	struct IsCombinable : std::false_type {};
+
+	template<typename T>
+	struct IsCombinable<CombinableState<T>> : std::true_type {};
+}
@@ -5,6 +5,9 @@
 #include <limits>
 #include <intrin.h>
 #include <algorithm>
+#include <memory_resource>
+#include <vector>
+#include <atomic>
 
 #include "small_vector.h"
 #include "vector.h"
@@ -52,6 +55,11 @@ namespace HBV
 		return _BitScanForward64(&result, id) ? result : 0;
 	}
 	
+	index_t popcount(flag_t x)
+	{
+		return (index_t)__popcnt64(x);
+	}
+
 	index_t highbit_pos(flag_t id)
 	{
 		unsigned long result;
@@ -69,17 +77,99 @@ namespace HBV
 		{
 			static constexpr index_t bits = BitsPerLayer * 2;
 			static constexpr index_t mask = (1 << bits) - 1;
-			lni::vector<flag_t*> _blocks;
+			//copies of a vector share its blocks until either side writes one
+			//a block goes back to the resource that allocated it, which must outlive the copies
+			struct shared_block
+			{
+				std::atomic<uint32_t> refs;
+				std::pmr::memory_resource* resource;
+				flag_t words[1 << bits];
+			};
+			std::pmr::memory_resource* _resource;
+			std::pmr::vector<shared_block*> _blocks;
 			index_t _size = 0;
+
+			shared_block* allocate_block()
+			{
+				shared_block* b = new(_resource->allocate(sizeof(shared_block), alignof(shared_block))) shared_block;
+				b->refs.store(1u, std::memory_order_relaxed);
+				b->resource = _resource;
+				return b;
+			}
+
+			static void release(shared_block* b) noexcept
+			{
+				if (b->refs.fetch_sub(1u, std::memory_order_acq_rel) == 1u)
+					b->resource->deallocate(b, sizeof(shared_block), alignof(shared_block));
+			}
+
+			void share() noexcept
+			{
+				for (auto b : _blocks)
+					if (b != nullptr)
+						b->refs.fetch_add(1u, std::memory_order_relaxed);
+			}
+
 		public:
+			block_vector(std::pmr::memory_resource* resource) noexcept
+				: _resource(resource), _blocks(resource) {}
+
+			block_vector(const block_vector& other, std::pmr::memory_resource* resource) noexcept
+				: _resource(resource), _blocks(other._blocks, resource), _size(other._size)
+			{
+				share();
+			}
+
+			block_vector(block_vector&& other) noexcept
+				: _resource(other._resource), _blocks(std::move(other._blocks)), _size(other._size)
+			{
+				other._blocks.clear();
+			}
+
+			block_vector& operator=(const block_vector& other)
+			{
+				if (this == &other)
+					return *this;
+				clear();
+				_blocks.assign(other._blocks.begin(), other._blocks.end());
+				_size = other._size;
+				share();
+				return *this;
+			}
+
+			block_vector& operator=(block_vector&& other) noexcept
+			{
+				if (this == &other)
+					return *this;
+				clear();
+				_blocks.assign(other._blocks.begin(), other._blocks.end());
+				_size = other._size;
+				other._blocks.clear();
+				return *this;
+			}
+
+			~block_vector()
+			{
+				clear();
+			}
+
+			std::pmr::memory_resource* resource() const noexcept
+			{
+				return _resource;
+			}
+
 			flag_t & operator[](index_t i)
 			{
-				return _blocks[i >> bits][i & mask];
+				return _blocks[i >> bits]->words[i & mask];
 			}
 
+			//a freed or missing block reads as empty, composed vectors don't free or grow blocks together
 			flag_t operator[](index_t i) const
 			{
-				return _blocks[i >> bits][i & mask];
+				if ((i >> bits) >= _blocks.size())
+					return EmptyNode;
+				const shared_block* b = _blocks[i >> bits];
+				return b != nullptr ? b->words[i & mask] : EmptyNode;
 			}
 
 			index_t size() const
@@ -103,7 +193,7 @@ namespace HBV
 
 			void erase_block(index_t i)
 			{
-				free(_blocks[i]);
+				release(_blocks[i]);
 				_blocks[i] = nullptr;
 			}
 
@@ -115,8 +205,52 @@ namespace HBV
 
 			void add_block(index_t i)
 			{
-				_blocks[i] = (flag_t*)malloc(sizeof(flag_t) * (1 << bits));
-				memset(_blocks[i], 0, sizeof(flag_t) * (1 << bits));
+				_blocks[i] = allocate_block();
+				memset(_blocks[i]->words, 0, sizeof(shared_block::words));
+			}
+
+			bool has_block(index_t i) const
+			{
+				return _blocks[i] != nullptr;
+			}
+
+			//copy a block shared with another vector before writing it
+			void try_own_block(index_t i)
+			{
+				shared_block* b = _blocks[i];
+				if (b == nullptr || b->refs.load(std::memory_order_acquire) == 1u)
+					return;
+				_blocks[i] = allocate_block();
+				memcpy(_blocks[i]->words, b->words, sizeof(shared_block::words));
+				release(b);
+			}
+
+			//allocated blocks and the table of them, a shared block counts for every copy
+			std::size_t bytes() const noexcept
+			{
+				std::size_t n = 0u;
+				for (auto b : _blocks)
+					n += b != nullptr;
+				return n * sizeof(shared_block) + _blocks.capacity() * sizeof(shared_block*);
+			}
+
+			//blocks this vector shares with a copy
+			index_t shared_blocks() const noexcept
+			{
+				index_t n = 0u;
+				for (auto b : _blocks)
+					n += b != nullptr && b->refs.load(std::memory_order_relaxed) > 1u;
+				return n;
+			}
+
+			flag_t* block(index_t i)
+			{
+				return _blocks[i]->words;
+			}
+
+			const flag_t* block(index_t i) const
+			{
+				return _blocks[i]->words;
 			}
 
 			void try_add_block(index_t i)
@@ -128,7 +262,7 @@ namespace HBV
 			void reset(index_t begin, index_t end)
 			{
 				index_t s = begin >> bits;
-				memset(_blocks[s] + (begin & mask), 0, ((end - begin) & mask) * sizeof(flag_t));
+				memset(_blocks[s]->words + (begin & mask), 0, ((end - begin) & mask) * sizeof(flag_t));
 			}
 
 			void fill(index_t begin, index_t end)
@@ -139,15 +273,15 @@ namespace HBV
 					if (_blocks[i] == nullptr)
 						add_block(i);
 				for (index_t i = s + 1; i < b; ++i)
-					memset(_blocks[i], -1, (1 << bits) * sizeof(flag_t));
+					memset(_blocks[i]->words, -1, (1 << bits) * sizeof(flag_t));
 				if (b > s)
 				{
-					memset(_blocks[s] + (begin & mask), -1, ((1 << bits) - (begin & mask)) * sizeof(flag_t));
-					memset(_blocks[b], -1, (end & mask) * sizeof(flag_t));
+					memset(_blocks[s]->words + (begin & mask), -1, ((1 << bits) - (begin & mask)) * sizeof(flag_t));
+					memset(_blocks[b]->words, -1, (end & mask) * sizeof(flag_t));
 				}
 				else
 				{
-					memset(_blocks[s] + (begin & mask), -1, ((end - begin) & mask) * sizeof(flag_t));
+					memset(_blocks[s]->words + (begin & mask), -1, ((end - begin) & mask) * sizeof(flag_t));
 				}
 			}
 
@@ -165,9 +299,41 @@ namespace HBV
 		index_t _end;
 		flag_t _layer0;
 		chobo::small_vector<flag_t> _layer1;
-		lni::vector<flag_t> _layer2;
+		std::pmr::vector<flag_t> _layer2;
 		//Ϊ˼ڴ,ֳblock
 		block_vector _layer3;
+		//epoch of every layer1 node, a node older than _epoch reads as empty and is zeroed on its next write
+		chobo::small_vector<uint32_t> _epochs;
+		uint32_t _epoch = 0u;
+
+		bool fresh(index_t index_1) const noexcept
+		{
+			return _epochs[index_1] == _epoch;
+		}
+
+		//stale upper layers still mark the non empty words below them, only those are zeroed
+		void touch(index_t index_1) noexcept
+		{
+			if (fresh(index_1))
+				return;
+			_epochs[index_1] = _epoch;
+			bool block = _layer3.has_block(index_1);
+			for (flag_t node1 = _layer1[index_1]; node1 != EmptyNode; node1 &= node1 - 1)
+			{
+				index_t index_2 = (index_1 << BitsPerLayer) | lowbit_pos(node1);
+				for (flag_t node2 = _layer2[index_2]; block && node2 != EmptyNode; node2 &= node2 - 1)
+					_layer3[(index_2 << BitsPerLayer) | lowbit_pos(node2)] = EmptyNode;
+				_layer2[index_2] = EmptyNode;
+			}
+			_layer1[index_1] = EmptyNode;
+		}
+
+		//before writing into node index_1, its block may be shared with a copy
+		void own(index_t index_1)
+		{
+			_layer3.try_own_block(index_1);
+			touch(index_1);
+		}
 
 		void set_range_true(index_t begin, index_t end)
 		{
@@ -204,6 +370,13 @@ namespace HBV
 				_layer##N[end] |= (value_of<N>(endPos) - 1) + value_of<N>(endPos); \
 			}
 
+			//make sure every touched layer3 block exists
+			for (index_t i = index_of<1>(startPos); i <= index_of<1>(endPos); ++i)
+			{
+				own(i);
+				_layer3.try_add_block(i);
+			}
+
 			SET_LAYER3(3);
 			SET_LAYER12(2);
 			SET_LAYER12(1);
@@ -231,6 +404,7 @@ namespace HBV
 		void bubble_fill(index_t id)
 		{
 			index_t index_3 = index_of<3>(id); 
+			own(index_of<1>(id));
 			_layer3.try_add_block(index_of<1>(id));
 			if (_layer3[index_3] == EmptyNode)
 			{
@@ -244,67 +418,35 @@ namespace HBV
 		{
 			index_t startPos = begin;
 			index_t endPos = end - 1;
+			index_t start = index_of<3>(startPos);
+			index_t last = index_of<3>(endPos);
 
-			
-
-			if (index_of<2>(startPos) == index_of<2>(endPos))
-			{
-				_layer2[index_of<2>(startPos)] &= ~(value_of<2>(endPos) - value_of<2>(startPos) * 2);
-				bubble_empty(startPos);
-			}
-			else
+			//clear word by word, words in missing blocks are already empty
+			for (index_t i = start; i <= last; ++i)
 			{
-				index_t start = index_of<2>(startPos);
-				index_t end = index_of<2>(endPos);
-				if (start + 1 < end)
-					std::fill(&_layer2[start + 1], &_layer2[end], EmptyNode);
-				_layer2[start] &= (value_of<2>(startPos) - 1) + value_of<2>(startPos);
-				_layer2[end] &= FullNode - value_of<2>(endPos) + 1;
-			}
-
-			if (index_of<1>(startPos) == index_of<1>(endPos))
-			{
-				_layer1[index_of<1>(startPos)] &= ~(value_of<1>(endPos) - value_of<1>(startPos) * 2);
-				if (_layer1[index_of<1>(startPos)] != EmptyNode)
+				index_t id = i << BitsPerLayer;
+				if (!_layer3.has_block(index_of<1>(id)) || !fresh(index_of<1>(id)))
 				{
-					_layer3.reset(index_of<3>(startPos), index_of<3>(endPos));
-					bubble_empty(startPos);
+					i = ((index_of<1>(id) + 1) << (BitsPerLayer * 2)) - 1;
+					continue;
 				}
-			}
-			else
-			{
-				index_t start = index_of<1>(startPos);
-				index_t end = index_of<1>(endPos);
-				if (start + 1 < end)
-					std::fill(&_layer1[start + 1], &_layer1[end], EmptyNode);
-				_layer1[start] &= (value_of<1>(startPos) - 1) + value_of<1>(startPos);
-				_layer1[end] &= FullNode - value_of<1>(endPos) + 1;
-
-				if (_layer1[start] != EmptyNode)
-				{
-					_layer3.reset(index_of<3>(startPos), (start + 1) << (BitsPerLayer * 2) - 1);
-					bubble_empty(startPos);
-				}
-					
-				if (_layer1[end] != EmptyNode)
+				_layer3.try_own_block(index_of<1>(id));
+				flag_t mask = FullNode;
+				if (i == start)
+					mask &= ~(value_of<3>(startPos) - 1);
+				if (i == last)
+					mask &= (value_of<3>(endPos) - 1) + value_of<3>(endPos);
+				if (_layer3[i] & mask)
 				{
-					_layer3.reset(end << (BitsPerLayer * 2), index_of<3>(endPos));
-					bubble_empty(endPos);
+					_layer3[i] &= ~mask;
+					bubble_empty(id);
 				}
-					
-
-				for (index_t i = start; i <= end; ++i)
-					if (_layer1[i] == EmptyNode)
-						_layer3.try_erase_block(i);
-
 			}
-
-			_layer0 &= ~((value_of<0>(endPos) - value_of<0>(startPos)) + value_of<0>(endPos));
-
 		}
 
 	public:
-		bit_vector(index_t max, bool fill = false) noexcept
+		bit_vector(index_t max, bool fill = false, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+			: _layer2(resource), _layer3(resource)
 		{
 			_layer0 = 0u;
 			_end = max - 1;
@@ -324,11 +466,59 @@ namespace HBV
 				_layer2.resize(index_of<2>(_end) + 1, 0u);
 				_layer1.resize(index_of<1>(_end) + 1, 0u);
 			}
+			_epochs.resize(_layer1.size(), _epoch);
 		}
 
 		bit_vector() noexcept 
 			: bit_vector(10) {}
 
+		//a copy shares the layer3 blocks, a block is copied when either side writes it
+		bit_vector(const bit_vector& other, std::pmr::memory_resource* resource) noexcept
+			: _end(other._end), _layer0(other._layer0), _layer1(other._layer1), _layer2(other._layer2, resource),
+			_layer3(other._layer3, resource), _epochs(other._epochs), _epoch(other._epoch) {}
+
+		bit_vector(const bit_vector& other) noexcept
+			: bit_vector(other, other._layer3.resource()) {}
+
+		bit_vector(bit_vector&&) noexcept = default;
+		bit_vector& operator=(const bit_vector&) = default;
+		bit_vector& operator=(bit_vector&&) noexcept = default;
+
+		std::pmr::memory_resource* resource() const noexcept
+		{
+			return _layer3.resource();
+		}
+
+		//layer3 blocks shared with copies, only the upper layers of a fresh copy are its own
+		index_t shared_blocks() const noexcept
+		{
+			return _layer3.shared_blocks();
+		}
+
+		//bytes held by each layer, epochs count with layer1
+		std::array<std::size_t, LayerCount> bytes() const noexcept
+		{
+			return { sizeof(_layer0), _layer1.capacity() * sizeof(flag_t) + _epochs.capacity() * sizeof(uint32_t),
+				_layer2.capacity() * sizeof(flag_t), _layer3.bytes() };
+		}
+
+		//set bits, only non empty nodes are visited
+		index_t count() const noexcept
+		{
+			index_t n = 0u;
+			for (flag_t node0 = _layer0; node0 != EmptyNode; node0 &= node0 - 1)
+			{
+				index_t index_1 = lowbit_pos(node0);
+				for (flag_t node1 = layer1(index_1); node1 != EmptyNode; node1 &= node1 - 1)
+				{
+					index_t index_2 = (index_1 << BitsPerLayer) | lowbit_pos(node1);
+					for (flag_t node2 = _layer2[index_2]; node2 != EmptyNode; node2 &= node2 - 1)
+						n += popcount(_layer3[(index_2 << BitsPerLayer) | lowbit_pos(node2)]);
+				}
+			}
+			return n;
+		}
+
 		void grow_to(index_t to, bool set = false) noexcept
 		{
 			to -= 1;
@@ -337,6 +527,7 @@ namespace HBV
 			_layer3.resize(index_of<3>(to) + 1, 0u);
 			_layer2.resize(index_of<2>(to) + 1, 0u);
 			_layer1.resize(index_of<1>(to) + 1, 0u);
+			_epochs.resize(_layer1.size(), _epoch);
 			if (set)
 				set_range(_end + 1, to + 1, true);
 			_end = to;
@@ -349,6 +540,9 @@ namespace HBV
 
 		void set_range(index_t begin, index_t end, bool value)
 		{
+			//both ways work on [begin, end - 1]
+			if (begin >= end)
+				return;
 			if (value)
 				set_range_true(begin, end);
 			else
@@ -365,19 +559,22 @@ namespace HBV
 			return _layer0;
 		}
 
+		//composed with a longer vector, ids past the end read as empty like layer3
 		flag_t layer1(index_t id) const noexcept
 		{
-			return _layer1[id];
+			return id < _epochs.size() && fresh(id) ? _layer1[id] : EmptyNode;
 		}
 
 		flag_t layer2(index_t id) const noexcept
 		{
-			return _layer2[id];
+			return id < _layer2.size() && (id >> BitsPerLayer) < _epochs.size() && fresh(id >> BitsPerLayer) ? _layer2[id] : EmptyNode;
 		}
 
 		flag_t layer3(index_t id) const noexcept
 		{
-			return _layer3[id];
+			//composed with a longer vector, ids past the end read as empty
+			index_t index_1 = id >> (BitsPerLayer * 2);
+			return index_1 < _epochs.size() && fresh(index_1) ? _layer3[id] : EmptyNode;
 		}
 
 		void set(index_t id, bool value) noexcept
@@ -391,22 +588,116 @@ namespace HBV
 				bubble_fill(id);
 				_layer3[index_3] |= value_3;
 			}
-			else
+			else if (_layer3.has_block(index_of<1>(id)) && fresh(index_of<1>(id)))
 			{
 				//bubble for empty node
+				_layer3.try_own_block(index_of<1>(id));
 				_layer3[index_3] &= ~value_3;
 				bubble_empty(id);
 			}
 		}
 
+		//or bits into a whole leaf word
+		void merge_word(index_t index_3, flag_t bits) noexcept
+		{
+			if (bits == EmptyNode)
+				return;
+			bubble_fill(index_3 << BitsPerLayer);
+			_layer3[index_3] |= bits;
+		}
+
 		void clear() noexcept
 		{
 			_layer3.clear();
 			std::fill(_layer2.begin(), _layer2.end(), 0u);
 			std::fill(_layer1.begin(), _layer1.end(), 0u);
+			std::fill(_epochs.begin(), _epochs.end(), _epoch);
 			_layer0 = 0u;
 		}
 
+		//clear in O(1), nodes are zeroed when next written and their blocks kept for reuse
+		void expire() noexcept
+		{
+			_layer0 = 0u;
+			if (++_epoch == 0u)
+				clear();
+		}
+
+		//raw layers for a snapshot, stale nodes are written empty and only non empty blocks are kept
+		template<typename Writer>
+		void save(Writer& out) const
+		{
+			constexpr std::size_t blockBytes = sizeof(flag_t) << (BitsPerLayer * 2);
+			index_t sizes[] = { index_t(_layer1.size()), index_t(_layer2.size()), _layer3.size() };
+			out.Write(_end);
+			out.Write(_layer0);
+			out.Write(sizes);
+			std::vector<flag_t> nodes(_layer2.size());
+			for (index_t i = 0; i < sizes[0]; ++i)
+				nodes[i] = layer1(i);
+			out.Write(nodes.data(), sizes[0] * sizeof(flag_t));
+			index_t blocks = 0u;
+			for (index_t i = 0; i < sizes[0]; ++i)
+				blocks += nodes[i] != EmptyNode;
+			for (index_t i = 0; i < sizes[1]; ++i)
+				nodes[i] = layer2(i);
+			out.Write(nodes.data(), sizes[1] * sizeof(flag_t));
+			out.Write(blocks);
+			for (index_t i = 0; i < sizes[0]; ++i)
+				if (layer1(i) != EmptyNode)
+				{
+					out.Write(i);
+					out.Write(_layer3.block(i), blockBytes);
+				}
+		}
+
+		//replaces the whole content with one written by save
+		template<typename Reader>
+		void load(Reader& in)
+		{
+			constexpr std::size_t blockBytes = sizeof(flag_t) << (BitsPerLayer * 2);
+			clear();
+			_end = in.template Read<index_t>();
+			_layer0 = in.template Read<flag_t>();
+			index_t sizes[3];
+			for (auto& size : sizes)
+				size = in.template Read<index_t>();
+			//each layer has at most 64 nodes for a node above it, and _end lies in the last word
+			in.Require(sizes[0] <= (1u << BitsPerLayer) && sizes[1] <= (sizes[0] << BitsPerLayer) && sizes[2] <= (sizes[1] << BitsPerLayer)
+				&& index_of<3>(_end) < sizes[2], "snapshot bit_vector sizes don't match");
+			//a set bit only points at a node that was loaded
+			auto within = [](flag_t node, index_t first, index_t size)
+			{
+				if (first >= size)
+					return node == EmptyNode;
+				return size - first >= (1u << BitsPerLayer) || (node >> (size - first)) == EmptyNode;
+			};
+			in.Require(within(_layer0, 0u, sizes[0]), "snapshot layer0 is out of range");
+			auto layer1 = in.Read(sizes[0], sizeof(flag_t));
+			_layer1.resize(sizes[0]);
+			memcpy(_layer1.data(), layer1, sizes[0] * sizeof(flag_t));
+			for (index_t i = 0; i < sizes[0]; ++i)
+				in.Require(within(_layer1[i], i << BitsPerLayer, sizes[1]), "snapshot layer1 is out of range");
+			auto layer2 = in.Read(sizes[1], sizeof(flag_t));
+			_layer2.resize(sizes[1]);
+			memcpy(_layer2.data(), layer2, sizes[1] * sizeof(flag_t));
+			for (index_t i = 0; i < sizes[1]; ++i)
+				in.Require(within(_layer2[i], i << BitsPerLayer, sizes[2]), "snapshot layer2 is out of range");
+			_layer3.resize(sizes[2]);
+			_epochs.resize(sizes[0]);
+			std::fill(_epochs.begin(), _epochs.end(), _epoch);
+			index_t blocks = in.template Read<index_t>();
+			for (index_t b = 0; b < blocks; ++b)
+			{
+				index_t i = in.template Read<index_t>();
+				in.Require(i < sizes[0] && i <= (sizes[2] >> (BitsPerLayer * 2)) && !_layer3.has_block(i), "snapshot block is out of range");
+				_layer3.add_block(i);
+				memcpy(_layer3.block(i), in.Read(blockBytes), blockBytes);
+			}
+			for (index_t i = 0; i < sizes[0]; ++i)
+				in.Require(_layer1[i] == EmptyNode || _layer3.has_block(i), "snapshot block is missing");
+		}
+
 		//NOTE: it won't grow
 		template<bool reverse = false, typename T>
 		void merge(const T& vec)
@@ -431,10 +722,18 @@ namespace HBV
 					if (id >= _layer3.size()) return;
 					
 					HBV::flag_t node = vec.layer3(id);
-					if constexpr(reverse)
+					//upper layers of a composed vector may cover empty words
+					if (node == EmptyNode)
 					{
-						_layer3[id] &= ~node;
-						bubble_empty(id << BitsPerLayer);
+					}
+					else if constexpr(reverse)
+					{
+						if (_layer3.has_block(index_of<1>(id << BitsPerLayer)) && fresh(index_of<1>(id << BitsPerLayer)))
+						{
+							_layer3.try_own_block(index_of<1>(id << BitsPerLayer));
+							_layer3[id] &= ~node;
+							bubble_empty(id << BitsPerLayer);
+						}
 					}
 					else
 					{
@@ -456,6 +755,12 @@ namespace HBV
 					else
 						nodes[level] = vec.layer(level, id);
 					prefix[level] = id << BitsPerLayer;
+					while (nodes[level] == EmptyNode)
+					{
+						if (level == 0)
+							return;
+						--level;
+					}
 				}
 			}
 		}
@@ -464,7 +769,7 @@ namespace HBV
 		{
 			index_t index_3 = index_of<3>(id);
 			index_t index_1 = index_of<1>(id);
-			return (index_3 < _layer3.size()) && (_layer1[index_1] > 0) && (_layer3[index_3] & value_of<3>(id));
+			return (index_3 < _layer3.size()) && fresh(index_1) && (_layer1[index_1] > 0) && (_layer3[index_3] & value_of<3>(id));
 		}
 
 		flag_t layer(index_t level, index_t id) const noexcept
@@ -632,19 +937,20 @@ namespace HBV
 			_layer0 = value;*/
 		}
 
+		//any node may hold a missing bit, only the leaves are exact
 		flag_t layer0() const noexcept
 		{
-			return (1 << BitsPerLayer - 1);// _layer0;
+			return FullNode;
 		}
 
 		flag_t layer1(index_t id) const noexcept
 		{
-			return (1 << BitsPerLayer - 1);//_layer1[id];
+			return FullNode;
 		}
 
 		flag_t layer2(index_t id) const noexcept
 		{
-			return (1 << BitsPerLayer - 1);//_layer2[id];
+			return FullNode;
 		}
 
 		flag_t layer3(index_t id) const noexcept
@@ -654,7 +960,76 @@ namespace HBV
 
 		bool contain(index_t id) const noexcept
 		{
-			return ~_node.contain(id);
+			return !_node.contain(id);
+		}
+
+		flag_t layer(index_t level, index_t id) const noexcept
+		{
+			switch (level)
+			{
+			case 0:
+				return layer0();
+			case 1:
+				return layer1(id);
+			case 2:
+				return layer2(id);
+			case 3:
+				return layer3(id);
+			default:
+				return 0;
+			}
+		}
+	};
+
+	//and of a list of vectors only known at runtime, empty if the list is
+	class bit_vector_dynamic_and
+	{
+		chobo::small_vector<const bit_vector*, 8> _nodes;
+
+	public:
+		template<typename It>
+		bit_vector_dynamic_and(It first, It last) : _nodes(first, last) {}
+
+		flag_t layer0() const noexcept
+		{
+			if (_nodes.empty())
+				return EmptyNode;
+			flag_t result = FullNode;
+			for (auto node : _nodes)
+				result &= node->layer0();
+			return result;
+		}
+
+		flag_t layer1(index_t id) const noexcept
+		{
+			flag_t result = FullNode;
+			for (auto node : _nodes)
+				result &= node->layer1(id);
+			return result;
+		}
+
+		flag_t layer2(index_t id) const noexcept
+		{
+			flag_t result = FullNode;
+			for (auto node : _nodes)
+				result &= node->layer2(id);
+			return result;
+		}
+
+		flag_t layer3(index_t id) const noexcept
+		{
+			flag_t result = FullNode;
+			for (auto node : _nodes)
+				result &= node->layer3(id);
+			return result;
+		}
+
+		bool contain(index_t id) const noexcept
+		{
+			return !_nodes.empty() && std::all_of(_nodes.begin(), _nodes.end(), [id](const bit_vector* node)
+			{
+				return node->contain(id);
+			});
 		}
 
 		flag_t layer(index_t level, index_t id) const noexcept
@@ -755,16 +1130,308 @@ namespace HBV
 				prefix[level] = id << BitsPerLayer;
 			}
 			else //tree node, iterate child
-			{
 				f(id);
-				while (nodes[level] == EmptyNode)
+			//upper layers of a composed vector may cover empty children
+			while (nodes[level] == EmptyNode)
+			{
+				//root is empty, stop iterating
+				if (level == 0)
+					return;
+				--level;
+			}
+		}
+	}
+
+	//for_each in id order, runs of full leaf words go to range(begin, end) as a whole
+	//so dense vectors are walked by a counted loop instead of a bit scan per id
+	template<typename T, typename F, typename R>
+	void for_each_range(const T& vec, const F& f, const R& range) noexcept
+	{
+		index_t begin = 0u;
+		index_t end = 0u;
+		for_each<2>(vec, [&vec, &f, &range, &begin, &end](index_t id)
+		{
+			flag_t word = vec.layer(3, id);
+			index_t prefix = id << BitsPerLayer;
+			if (word == FullNode && prefix == end)
+			{
+				end += 1u << BitsPerLayer;
+				return;
+			}
+			if (begin != end)
+				range(begin, end);
+			begin = end = prefix;
+			if (word == FullNode)
+				end += 1u << BitsPerLayer;
+			else
+				for (; word != EmptyNode; word &= word - 1)
+					f(prefix | lowbit_pos(word));
+		});
+		if (begin != end)
+			range(begin, end);
+	}
+
+	//for_each until f returns true, returns whether it stopped
+	template<index_t Level = 3, typename T, typename F>
+	bool for_each_until(const T& vec, const F& f) noexcept
+	{
+		std::array<flag_t, Level + 1> nodes{};
+		std::array<index_t, Level + 1> prefix{};
+		nodes[0] = vec.layer0();
+		index_t level = 0;
+		if (nodes[0] == EmptyNode) return false;
+
+		for (;;)
+		{
+			index_t low = lowbit_pos(nodes[level]);
+			nodes[level] &= ~(flag_t(1u) << low);
+			index_t id = prefix[level] | low;
+			if (level < Level)
+			{
+				++level;
+				nodes[level] = vec.layer(level, id);
+				prefix[level] = id << BitsPerLayer;
+			}
+			else if (f(id))
+				return true;
+			while (nodes[level] == EmptyNode)
+			{
+				if (level == 0)
+					return false;
+				--level;
+			}
+		}
+	}
+
+	//set bits of a composed vector, a popcount per non empty leaf word
+	template<typename T>
+	index_t count(const T& vec) noexcept
+	{
+		index_t n = 0u;
+		for_each<2>(vec, [&vec, &n](index_t id)
+		{
+			n += popcount(vec.layer(3, id));
+		});
+		return n;
+	}
+
+	//bit begin + i takes bit order[i], order is a permutation of [begin, begin + order.size())
+	//vec must already cover the range
+	template<typename Order>
+	void permute(bit_vector& vec, index_t begin, const Order& order)
+	{
+		if (order.empty())
+			return;
+		index_t end = begin + (index_t)order.size();
+		index_t base = index_of<3>(begin);
+		std::vector<flag_t> words(index_of<3>(end - 1) - base + 1, EmptyNode);
+		for (index_t i = 0; i < order.size(); ++i)
+			if (vec.contain(order[i]))
+				words[index_of<3>(begin + i) - base] |= value_of<3>(begin + i);
+		vec.set_range(begin, end, false);
+		for (index_t i = 0; i < words.size(); ++i)
+			vec.merge_word(base + i, words[i]);
+	}
+
+	//change stamp per id, since(v, last) is a view of the ids stamped in (v, last] that composes like a bit_vector
+	//upper layers keep the max stamp below them, they may over estimate after a clear or past last
+	class version_vector
+	{
+	public:
+		using stamp_t = uint32_t;
+
+		class view
+		{
+			const version_vector& _vec;
+			stamp_t _since;
+			stamp_t _last;
+
+			bool within(stamp_t stamp) const noexcept
+			{
+				return stamp > _since && stamp <= _last;
+			}
+
+			flag_t above(const std::pmr::vector<stamp_t>& stamps, index_t id) const noexcept
+			{
+				index_t base = id << BitsPerLayer;
+				if (base >= stamps.size())
+					return EmptyNode;
+				index_t count = std::min<index_t>(index_t(stamps.size()) - base, 1u << BitsPerLayer);
+				flag_t bits = EmptyNode;
+				for (index_t i = 0; i < count; ++i)
+					bits |= flag_t(stamps[base + i] > _since) << i;
+				return bits;
+			}
+
+		public:
+			view(const version_vector& vec, stamp_t since, stamp_t last) noexcept
+				: _vec(vec), _since(since), _last(last) {}
+
+			flag_t layer0() const noexcept
+			{
+				return above(_vec._max1, 0u);
+			}
+
+			flag_t layer1(index_t id) const noexcept
+			{
+				return above(_vec._max2, id);
+			}
+
+			flag_t layer2(index_t id) const noexcept
+			{
+				return above(_vec._max3, id);
+			}
+
+			flag_t layer3(index_t id) const noexcept
+			{
+				index_t base = id << BitsPerLayer;
+				if (base >= _vec._stamps.size())
+					return EmptyNode;
+				index_t count = std::min<index_t>(index_t(_vec._stamps.size()) - base, 1u << BitsPerLayer);
+				flag_t bits = EmptyNode;
+				for (index_t i = 0; i < count; ++i)
+					bits |= flag_t(within(_vec._stamps[base + i])) << i;
+				return bits;
+			}
+
+			bool contain(index_t id) const noexcept
+			{
+				return id < _vec._stamps.size() && within(_vec._stamps[id]);
+			}
+
+			flag_t layer(index_t level, index_t id) const noexcept
+			{
+				switch (level)
 				{
-					//root is empty, stop iterating
-					if (level == 0)
-						return;
-					--level;
+				case 0:
+					return layer0();
+				case 1:
+					return layer1(id);
+				case 2:
+					return layer2(id);
+				case 3:
+					return layer3(id);
+				default:
+					return 0;
 				}
 			}
+		};
+
+	private:
+		std::pmr::vector<stamp_t> _stamps;
+		//max stamp of each layer3 word, layer2 node and layer1 node
+		std::pmr::vector<stamp_t> _max3;
+		std::pmr::vector<stamp_t> _max2;
+		std::pmr::vector<stamp_t> _max1;
+
+		void raise(index_t id, stamp_t v) noexcept
+		{
+			_max3[id >> BitsPerLayer] = std::max(_max3[id >> BitsPerLayer], v);
+			_max2[id >> BitsPerLayer * 2] = std::max(_max2[id >> BitsPerLayer * 2], v);
+			_max1[id >> BitsPerLayer * 3] = std::max(_max1[id >> BitsPerLayer * 3], v);
 		}
-	}
+
+		//exact maxima again for the nodes over [begin, end)
+		void refresh(index_t begin, index_t end) noexcept
+		{
+			for (index_t w = begin >> BitsPerLayer; w <= (end - 1) >> BitsPerLayer; ++w)
+			{
+				index_t first = w << BitsPerLayer;
+				index_t last = std::min<index_t>(first + (1u << BitsPerLayer), index_t(_stamps.size()));
+				_max3[w] = *std::max_element(&_stamps[first], &_stamps[0] + last);
+			}
+			for (index_t n = begin >> BitsPerLayer * 2; n <= (end - 1) >> BitsPerLayer * 2; ++n)
+			{
+				index_t first = n << BitsPerLayer;
+				index_t last = std::min<index_t>(first + (1u << BitsPerLayer), index_t(_max3.size()));
+				_max2[n] = *std::max_element(&_max3[first], &_max3[0] + last);
+			}
+			for (index_t n = begin >> BitsPerLayer * 3; n <= (end - 1) >> BitsPerLayer * 3; ++n)
+			{
+				index_t first = n << BitsPerLayer;
+				index_t last = std::min<index_t>(first + (1u << BitsPerLayer), index_t(_max2.size()));
+				_max1[n] = *std::max_element(&_max2[first], &_max2[0] + last);
+			}
+		}
+
+	public:
+		version_vector(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+			: _stamps(resource), _max3(resource), _max2(resource), _max1(resource) {}
+
+		//stamps are copied, not shared
+		version_vector(const version_vector& other, std::pmr::memory_resource* resource) noexcept
+			: _stamps(other._stamps, resource), _max3(other._max3, resource), _max2(other._max2, resource), _max1(other._max1, resource) {}
+
+		index_t size() const noexcept
+		{
+			return index_t(_stamps.size());
+		}
+
+		std::size_t bytes() const noexcept
+		{
+			return (_stamps.capacity() + _max3.capacity() + _max2.capacity() + _max1.capacity()) * sizeof(stamp_t);
+		}
+
+		void grow_to(index_t to) noexcept
+		{
+			to = std::min<index_t>(16'777'216u, to);
+			if (to <= _stamps.size())
+				return;
+			_stamps.resize(to, 0u);
+			_max3.resize(((to - 1) >> BitsPerLayer) + 1, 0u);
+			_max2.resize(((to - 1) >> BitsPerLayer * 2) + 1, 0u);
+			_max1.resize(((to - 1) >> BitsPerLayer * 3) + 1, 0u);
+		}
+
+		stamp_t get(index_t id) const noexcept
+		{
+			return id < _stamps.size() ? _stamps[id] : 0u;
+		}
+
+		void stamp(index_t id, stamp_t v) noexcept
+		{
+			if (_stamps.size() <= id)
+				grow_to(id + 64 * 64);
+			_stamps[id] = v;
+			raise(id, v);
+		}
+
+		void stamp_range(index_t begin, index_t end, stamp_t v) noexcept
+		{
+			if (begin >= end)
+				return;
+			if (_stamps.size() < end)
+				grow_to(end);
+			std::fill(&_stamps[begin], &_stamps[0] + end, v);
+			for (index_t w = begin >> BitsPerLayer; w <= (end - 1) >> BitsPerLayer; ++w)
+				raise(w << BitsPerLayer, v);
+		}
+
+		void clear(index_t id) noexcept
+		{
+			if (id < _stamps.size())
+				_stamps[id] = 0u;
+		}
+
+		//last bounds the view to a cursor's run, stamps taken after it are left to the next run
+		view since(stamp_t v, stamp_t last = (std::numeric_limits<stamp_t>::max)()) const noexcept
+		{
+			return { *this, v, last };
+		}
+
+		//id begin + i takes the stamp of order[i]
+		template<typename Order>
+		void permute(index_t begin, const Order& order)
+		{
+			if (order.empty())
+				return;
+			index_t end = begin + (index_t)order.size();
+			std::vector<stamp_t> stamps(order.size());
+			for (index_t i = 0; i < order.size(); ++i)
+				stamps[i] = get(order[i]);
+			grow_to(end);
+			std::copy(stamps.begin(), stamps.end(), &_stamps[begin]);
+			refresh(begin, end);
+		}
+	};
 }
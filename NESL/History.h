@@ -0,0 +1,120 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <utility>
+#include "States.h"
+
+namespace ESL
+{
+	//last Frames frames of one component, for rollback and replay
+	//the state needs Create, Remove and Borrow tracers, only the entities they flag are recorded
+	//a full copy of the last recorded frame is kept, each frame of the ring stores how to undo it
+	//entity lifetime is not part of the history, only values and membership of T are rewound
+	//unchanged values are skipped by UniqueTrait<T>::Equal, so T with padding or floats needs operator==
+	template<typename T, std::size_t Frames>
+	class History
+	{
+		using ST = State<T>;
+		static_assert(!IsTagState<ST>{}, "tags have no history!");
+
+		struct Delta
+		{
+			//entities without T before the frame
+			std::vector<index_t> created;
+			//entities with T before the frame and their value
+			std::vector<std::pair<index_t, T>> changed;
+		};
+
+		ST& _state;
+		std::array<Delta, Frames> _deltas;
+		HBV::bit_vector _has;
+		std::vector<T> _values;
+		std::size_t _frame = 0u;
+		std::size_t _recorded = 0u;
+
+		void Store(index_t e, const T& value)
+		{
+			if (_has.size() <= e)
+				_has.grow_to(e + 64 * 64);
+			if (_values.size() <= e)
+				_values.resize(e + 64 * 64);
+			_values[e] = value;
+			_has.set(e, true);
+		}
+
+	public:
+		//the current content of the state is frame 0
+		History(States& states) : _state(*states.GetState<T>())
+		{
+			HBV::for_each(_state.template Available<Trace::Has>(), [this](index_t e)
+			{
+				Store(e, std::as_const(_state).Get(e));
+			});
+		}
+
+		//call once a frame after Tick and before the tracers are reset, returns the recorded frame
+		std::size_t Record()
+		{
+			auto& delta = _deltas[++_frame % Frames];
+			delta.created.clear();
+			delta.changed.clear();
+			const ST& state = _state;
+			HBV::for_each(state.template Available<Trace::CRB>(), [this, &delta, &state](index_t e)
+			{
+				bool had = _has.contain(e);
+				bool has = state.Contain(e);
+				if (had)
+				{
+					if (has && UniqueTrait<T>::Equal(_values[e], state.Get(e)))
+						return;
+					delta.changed.emplace_back(e, _values[e]);
+				}
+				else if (has)
+					delta.created.push_back(e);
+				else
+					return;
+				if (has)
+					Store(e, state.Get(e));
+				else
+					_has.set(e, false);
+			});
+			_recorded = (std::min)(_recorded + 1, Frames);
+			return _frame;
+		}
+
+		//undo frames newest first, the Create, Remove and Borrow flags set by the undo are dropped
+		//flags other systems set before are kept, Versioned stamps and the Journal see the undo
+		void RewindTo(std::size_t frame)
+		{
+			assert(frame <= _frame && _frame - frame <= _recorded);
+			auto flags = _state.SaveFlags();
+			for (; _frame > frame; --_frame, --_recorded)
+			{
+				auto& delta = _deltas[_frame % Frames];
+				for (auto e : delta.created)
+				{
+					if (_state.Contain(e))
+						_state.Remove(e);
+					_has.set(e, false);
+				}
+				for (auto& pair : delta.changed)
+				{
+					_state.Create(pair.first, pair.second);
+					Store(pair.first, pair.second);
+				}
+			}
+			_state.RestoreFlags(flags);
+		}
+
+		std::size_t Frame() const noexcept
+		{
+			return _frame;
+		}
+
+		//the earliest frame RewindTo can reach
+		std::size_t Oldest() const noexcept
+		{
+			return _frame - _recorded;
+		}
+	};
+}
@@ -39,15 +39,22 @@ namespace ESL
 
 	class LogicGraph
 	{
-		States &_states;
+		//the world nodes fetch their states from when they run
+		States* _states;
 		struct LogicNode
 		{
 			//̽ڵ
 			chobo::small_vector<LogicNode*, 20> successors;
 			chobo::small_vector<std::size_t, 15> reads;
 			chobo::small_vector<std::size_t, 15> writes;
+			//double buffered states, only writers of the next frame conflict
+			chobo::small_vector<std::size_t, 15> writesNext;
+			//combinable states, writers run together and only order against readers
+			chobo::small_vector<std::size_t, 15> combines;
 			bool enabled;
 			bool parallel;
+			//last run, for versioned filters
+			Cursor cursor;
 			std::string name;
 			std::size_t inRef;
 			std::size_t id;
@@ -74,7 +81,8 @@ namespace ESL
 			{
 				if(warn)
 					std::cerr << "Warning: Unsolved dependency between [" << node->name << "] and [" << succ->name << "] due to conflict.\n";
-				succ->successors.push_back(succ);
+				node->successors.push_back(succ);
+				succ->from.push_back(node);
 				prefix.insert(node);
 			}
 		}
@@ -116,34 +124,65 @@ namespace ESL
 		void CheckGraph(bool fix = false)
 		{
 			if (!fix) Flatten();
+			//state ids are dense, the tables below are indexed by them
+			std::size_t count = 0u;
+			for (auto node : _flattenNodes)
+				for (auto ids : { &node->reads, &node->writes, &node->writesNext, &node->combines })
+					for (auto id : *ids)
+						count = (std::max)(count, id + 1);
 			//ÿstateĵǰĹ(ȡ)߼
-			std::unordered_map<std::size_t, chobo::small_vector<LogicNode*, 20>> readers;
+			std::vector<chobo::small_vector<LogicNode*, 20>> readers(count);
 			//ÿstateĵǰռ(д)߼
-			std::unordered_map<std::size_t, LogicNode*> writer;
+			std::vector<LogicNode*> writer(count, nullptr);
+			std::vector<LogicNode*> nextWriter(count, nullptr);
+			//writers of each combinable state since its last reader
+			std::vector<chobo::small_vector<LogicNode*, 20>> combiners(count);
 			for(auto node : _flattenNodes)
 			{
 				for(auto read : node->reads)
 				{
+					for (auto c : combiners[read])
+						CheckDependency(c, node, !fix);
 					//빲,һռ
 					readers[read].push_back(node);
-					if (auto iter = writer.find(read); iter != writer.end())
-						CheckDependency(iter->second, node, !fix);
+					if (writer[read] != nullptr)
+						CheckDependency(writer[read], node, !fix);
 				}
 
 				for(auto write : node->writes)
 				{
 					//֮ǰĹһռ,жռ
-					if (auto iter = readers.find(write); iter != readers.end() && !iter->second.empty())
+					if (auto& reader = readers[write]; !reader.empty())
 					{
-						auto& reader = iter->second;
 						for(auto r : reader)
 							CheckDependency(r, node, !fix);
 						reader.clear();
 					}
-					else if (auto iter = writer.find(write); iter != writer.end())
-						CheckDependency(iter->second, node, !fix);
+					else if (writer[write] != nullptr)
+						CheckDependency(writer[write], node, !fix);
 					writer[write] = node;
 				}
+
+				//after the readers, in parallel with the other combiners
+				for (auto write : node->combines)
+				{
+					if (auto& reader = readers[write]; !reader.empty())
+					{
+						for (auto r : reader)
+							CheckDependency(r, node, !fix);
+						reader.clear();
+						combiners[write].clear();
+					}
+					combiners[write].push_back(node);
+				}
+
+				//readers see the previous frame, so they never wait for the writer
+				for (auto write : node->writesNext)
+				{
+					if (nextWriter[write] != nullptr)
+						CheckDependency(nextWriter[write], node, !fix);
+					nextWriter[write] = node;
+				}
 			}
 			_checked = true;
 
@@ -162,36 +201,53 @@ namespace ESL
 
 		template<typename T>
 		void BuildGraph(T& graph);
-	public:
-		LogicGraph(States& s) : _states(s) {}
 
-		//߼,עϵ
-		template<typename Dispatcher = DefaultDispatcher, typename F, typename... Ts>
-		void Schedule(F&& f, std::string name, Ts... dependencies)
+		//every writer of a combinable state the node reads ran before it, fold their worker copies
+		template<typename S>
+		static void CombineReads(S& fetchedStates)
+		{
+			MPL::for_tuple(fetchedStates, [](auto& state)
+			{
+				using type = decltype(state);
+				if constexpr(IsCombinable<std::decay_t<type>>{} && MPL::is_const_v<type>)
+					state.Combine();
+			});
+		}
+
+		//a node with the reads and writes of the states f takes, the caller sets its task
+		template<typename F>
+		LogicNode* AddNode(const F& f, const std::string& name, std::size_t dependencies)
 		{
 			_checked = false;
-			auto fetchedStates = FetchFor(_states, f);
+			auto fetchedStates = FetchFor(*_states, f);
 			_graph.emplace_back(std::make_unique<LogicNode>());
 			auto& node = _graph.back();
-			if constexpr(sizeof...(Ts) == 0)
+			if (dependencies == 0)
 				_entry.emplace_back(node.get());
-			node->inRef = sizeof...(Ts);
+			node->inRef = dependencies;
 			node->id = _graph.size() - 1;
 			node->name = name;
 			node->enabled = true;
-			node->task = [fetchedStates, f = std::forward<F>(f), node = node.get()]()
-			{
-				if(node->enabled)
-					Dispatcher::Dispatch(fetchedStates, f);
-			};
-			MPL::for_tuple(fetchedStates, [&node](auto &wrapper)
+			MPL::for_tuple(fetchedStates, [this, &node](auto &wrapper)
 			{
 
 				using type = decltype(wrapper);
 				using intern = typename TStateNonstrict<std::decay_t<type>>::Raw;
-				std::size_t id = typeid(type).hash_code();
+				std::size_t id = _states->template Id<std::decay_t<type>>();
 
-				if constexpr(MPL::is_const_v<type>)
+				if constexpr(IsDoubleBuffered<std::decay_t<type>>{})
+				{
+					if constexpr(!MPL::is_const_v<type>)
+						node->writesNext.push_back(id);
+				}
+				else if constexpr(IsCombinable<std::decay_t<type>>{})
+				{
+					if constexpr(MPL::is_const_v<type>)
+						node->reads.push_back(id);
+					else
+						node->combines.push_back(id);
+				}
+				else if constexpr(MPL::is_const_v<type>)
 				{
 					//Hack!EntitiesĶ
 					if (!std::is_same_v<type, const GlobalState<Entities>&>)
@@ -200,9 +256,57 @@ namespace ESL
 				else
 					node->writes.push_back(id);
 			});
+			return node.get();
+		}
+	public:
+		LogicGraph(States& s) : _states(&s) {}
 
-			_nodeMap[std::move(name)] = node.get();
-			std::initializer_list<int> _ = { (TryAddNext(std::move(dependencies), node.get()), 0)... };
+		//tasks refer back to the graph
+		LogicGraph(const LogicGraph&) = delete;
+		LogicGraph& operator=(const LogicGraph&) = delete;
+
+		//run the same systems against another world, such as a fork of the first one
+		//it needs every state the systems use, built graphs follow it too
+		void Rebind(States& s) noexcept
+		{
+			_states = &s;
+		}
+
+		//߼,עϵ
+		template<typename Dispatcher = DefaultDispatcher, typename F, typename... Ts>
+		void Schedule(F&& f, std::string name, Ts... dependencies)
+		{
+			LogicNode* node = AddNode(f, name, sizeof...(Ts));
+			node->task = [this, f = std::forward<F>(f), node]()
+			{
+				if (!node->enabled)
+					return;
+				node->cursor.Advance();
+				auto fetchedStates = FetchFor(*_states, f);
+				CombineReads(fetchedStates);
+				Dispatcher::Dispatch(std::tuple_cat(fetchedStates, std::tie(std::as_const(node->cursor))), f);
+			};
+			_nodeMap[std::move(name)] = node;
+			std::initializer_list<int> _ = { (TryAddNext(std::move(dependencies), node), 0)... };
+		}
+
+		//a ReduceParallel over the entities of map, the node only reads the states map takes
+		//result belongs to the caller and is written each time the node runs
+		template<bool Deterministic = false, typename T, typename M, typename C, typename... Ts>
+		void ScheduleReduce(T& result, T identity, M&& map, C&& combine, std::string name, Ts... dependencies)
+		{
+			LogicNode* node = AddNode(map, name, sizeof...(Ts));
+			node->task = [this, &result, identity = std::move(identity), map = std::forward<M>(map), combine = std::forward<C>(combine), node]()
+			{
+				if (!node->enabled)
+					return;
+				node->cursor.Advance();
+				auto fetchedStates = FetchFor(*_states, map);
+				CombineReads(fetchedStates);
+				result = ReduceParallel<Deterministic>(std::tuple_cat(fetchedStates, std::tie(std::as_const(node->cursor))), identity, map, combine);
+			};
+			_nodeMap[std::move(name)] = node;
+			std::initializer_list<int> _ = { (TryAddNext(std::move(dependencies), node), 0)... };
 		}
 
 		//ֶϵ
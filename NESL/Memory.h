@@ -0,0 +1,284 @@
+#pragma once
+#include <memory_resource>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include <new>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ESL
+{
+	//copyable spin lock for containers, a copy starts unlocked
+	class SpinLock
+	{
+		std::atomic_flag _flag = ATOMIC_FLAG_INIT;
+	public:
+		SpinLock() noexcept = default;
+		SpinLock(const SpinLock&) noexcept {}
+		SpinLock& operator=(const SpinLock&) noexcept { return *this; }
+
+		void lock() noexcept
+		{
+			while (_flag.test_and_set(std::memory_order_acquire));
+		}
+
+		void unlock() noexcept
+		{
+			_flag.clear(std::memory_order_release);
+		}
+	};
+
+	//forward to upstream and count the bytes held, one per state
+	class CountingResource : public std::pmr::memory_resource
+	{
+		std::pmr::memory_resource* _upstream;
+		std::atomic<std::size_t> _bytes{ 0u };
+
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override
+		{
+			void* p = _upstream->allocate(bytes, alignment);
+			_bytes.fetch_add(bytes, std::memory_order_relaxed);
+			return p;
+		}
+
+		void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+		{
+			_upstream->deallocate(p, bytes, alignment);
+			_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+
+	public:
+		CountingResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) noexcept
+			: _upstream(upstream) {}
+
+		//a copy shares the upstream but starts counting from zero
+		CountingResource(const CountingResource& other) noexcept
+			: _upstream(other._upstream) {}
+
+		std::pmr::memory_resource* Upstream() const noexcept
+		{
+			return _upstream;
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return _bytes.load(std::memory_order_relaxed);
+		}
+	};
+
+	//reserve address space once, commit pages on demand
+	namespace VirtualMemory
+	{
+		//commit granularity, matches a transparent huge page
+		constexpr std::size_t HugePageSize = 2u << 20;
+
+		inline std::size_t AlignUp(std::size_t bytes, std::size_t alignment = HugePageSize) noexcept
+		{
+			return (bytes + alignment - 1) & ~(alignment - 1);
+		}
+
+		inline void* Reserve(std::size_t bytes) noexcept
+		{
+#ifdef _WIN32
+			return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+#else
+			void* p = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (p == MAP_FAILED)
+				return nullptr;
+#ifdef MADV_HUGEPAGE
+			madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+			return p;
+#endif
+		}
+
+		inline bool Commit(void* p, std::size_t bytes) noexcept
+		{
+#ifdef _WIN32
+			return VirtualAlloc(p, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+			return mprotect(p, bytes, PROT_READ | PROT_WRITE) == 0;
+#endif
+		}
+
+		inline void Release(void* p, std::size_t bytes) noexcept
+		{
+#ifdef _WIN32
+			VirtualFree(p, 0, MEM_RELEASE);
+#else
+			munmap(p, bytes);
+#endif
+		}
+	}
+
+	//read only mapping of a whole file, pages are read in on first touch
+	class MappedFile
+	{
+		const char* _data = nullptr;
+		std::size_t _size = 0u;
+#ifdef _WIN32
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = nullptr;
+#endif
+
+	public:
+		MappedFile(const char* path) noexcept
+		{
+#ifdef _WIN32
+			_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (_file == INVALID_HANDLE_VALUE)
+				return;
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+				return;
+			_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (_mapping == nullptr)
+				return;
+			_data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+			if (_data != nullptr)
+				_size = (std::size_t)size.QuadPart;
+#else
+			int fd = open(path, O_RDONLY);
+			if (fd < 0)
+				return;
+			struct stat info;
+			if (fstat(fd, &info) == 0 && info.st_size > 0)
+			{
+				void* p = mmap(nullptr, (std::size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED)
+				{
+					madvise(p, (std::size_t)info.st_size, MADV_SEQUENTIAL);
+					_data = (const char*)p;
+					_size = (std::size_t)info.st_size;
+				}
+			}
+			close(fd);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+
+		~MappedFile()
+		{
+#ifdef _WIN32
+			if (_data != nullptr)
+				UnmapViewOfFile(_data);
+			if (_mapping != nullptr)
+				CloseHandle(_mapping);
+			if (_file != INVALID_HANDLE_VALUE)
+				CloseHandle(_file);
+#else
+			if (_data != nullptr)
+				munmap((void*)_data, _size);
+#endif
+		}
+
+		const char* Data() const noexcept
+		{
+			return _data;
+		}
+
+		std::size_t Size() const noexcept
+		{
+			return _size;
+		}
+	};
+
+	//bump allocator over one reserved region, used as the upstream of a world
+	//freed memory is kept in per size and alignment free lists, which suits fixed size blocks
+	class VirtualResource : public std::pmr::memory_resource
+	{
+		using FreeKey = std::pair<std::size_t, std::size_t>;
+
+		struct FreeKeyHash
+		{
+			std::size_t operator()(const FreeKey& key) const noexcept
+			{
+				return std::hash<std::size_t>{}(key.first) ^ (std::hash<std::size_t>{}(key.second) << 1);
+			}
+		};
+
+		char* _base;
+		std::size_t _reserved;
+		std::size_t _committed = 0u;
+		std::size_t _used = 0u;
+		//a block freed with a smaller alignment may not suit a larger one
+		std::unordered_map<FreeKey, std::vector<void*>, FreeKeyHash> _free;
+		SpinLock _lock;
+
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override
+		{
+			std::lock_guard<SpinLock> guard{ _lock };
+			auto& free = _free[{ bytes, alignment }];
+			if (!free.empty())
+			{
+				void* p = free.back();
+				free.pop_back();
+				return p;
+			}
+			std::size_t offset = VirtualMemory::AlignUp(_used, alignment);
+			if (offset + bytes > _reserved)
+				throw std::bad_alloc{};
+			if (offset + bytes > _committed)
+			{
+				std::size_t to = (std::min)(VirtualMemory::AlignUp(offset + bytes), _reserved);
+				if (!VirtualMemory::Commit(_base + _committed, to - _committed))
+					throw std::bad_alloc{};
+				_committed = to;
+			}
+			_used = offset + bytes;
+			return _base + offset;
+		}
+
+		void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+		{
+			std::lock_guard<SpinLock> guard{ _lock };
+			_free[{ bytes, alignment }].push_back(p);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+
+	public:
+		VirtualResource(std::size_t reserve)
+			: _base((char*)VirtualMemory::Reserve(reserve)), _reserved(reserve)
+		{
+			if (_base == nullptr)
+				throw std::bad_alloc{};
+		}
+
+		VirtualResource(const VirtualResource&) = delete;
+
+		~VirtualResource()
+		{
+			VirtualMemory::Release(_base, _reserved);
+		}
+
+		std::size_t Committed() const noexcept
+		{
+			return _committed;
+		}
+	};
+}
@@ -22,12 +22,18 @@ namespace HBV
 		{
 			HBV::flag_t node = vec.layer3(id);
 			index_t prefix = id << HBV::BitsPerLayer;
-			do
+			if (node == HBV::FullNode)
+			{
+				for (index_t i = prefix; i < prefix + (1u << HBV::BitsPerLayer); ++i)
+					f(i);
+				return;
+			}
+			while (node)
 			{
 				index_t low = HBV::lowbit_pos(node);
 				node &= ~(HBV::flag_t(1) << low);
 				f(prefix | low);
-			} while (node); 
+			}
 		});
 	}
 }
@@ -52,6 +58,10 @@ namespace ESL
 		static_assert(MPL::size<Filters>{} > 0 || MPL::contain_v<Entity, DecayArgument>, "Parallel means nothing with global states."); //з
 		
 		const auto available = MPL::rewrap_t<Dispatcher::ComposeHelper, Filters>::ComposeBitVector(states);
+		//workers never write the tracers, Borrow is merged here in one pass before they run
+		using ValueStates = MPL::filter_t<IsRawValueState, RawEntityStates>;
+		MPL::rewrap_t<Dispatcher::BorrowHelper, ValueStates>::Mark(states, available);
+		MPL::rewrap_t<Dispatcher::BorrowHelper, ValueStates>::Own(states, available);
 		HBV::for_each_paralell(available, [&states, &logic](index_t i) //
 		{
 			MPL::rewrap_t<Dispatcher::EntityDispatchHelper, DecayArgument>::Dispatch(states, i, logic);
@@ -63,5 +73,111 @@ namespace ESL
 	{
 		DispatchParallel(FetchFor(states, logic), logic);
 	}
+
+	template<typename F>
+	auto DispatchParallel(States &states, F&& logic, Cursor& cursor)
+	{
+		cursor.Advance();
+		DispatchParallel(std::tuple_cat(FetchFor(states, logic), std::tie(std::as_const(cursor))), logic);
+	}
+
+	//Reduce with the leaf words split among workers by tbb::parallel_reduce, combine must be associative
+	//Deterministic splits and joins the same way on any number of threads, so float sums repeat exactly
+	template<bool Deterministic = false, typename T, typename M, typename C, typename S>
+	T ReduceParallel(S states, T identity, M&& map, C&& combine)
+	{
+		//leaf words per task, 1024 entities
+		constexpr std::size_t Grain = 16u;
+		using Trait = Dispatcher::ReduceTrait<M>;
+		typename Dispatcher::CheckFilters<typename Trait::ExplictFilters>::type checker; (void)checker;
+		using Helper = typename Trait::Helper;
+
+		const auto available = MPL::rewrap_t<Dispatcher::ComposeHelper, typename Trait::Filters>::ComposeBitVector(states);
+		lni::vector<index_t> words;
+		words.reserve(64u);
+		HBV::for_each<2>(available, [&words](index_t id)
+		{
+			words.push_back(id);
+		});
+		auto body = [&states, &map, &combine, &available, &words](const tbb::blocked_range<std::size_t>& range, T result)
+		{
+			for (std::size_t w = range.begin(); w != range.end(); ++w)
+			{
+				HBV::flag_t node = available.layer3(words[w]);
+				index_t prefix = words[w] << HBV::BitsPerLayer;
+				if (node == HBV::FullNode)
+				{
+					for (index_t i = prefix; i < prefix + (1u << HBV::BitsPerLayer); ++i)
+						result = combine(std::move(result), Helper::Dispatch(states, i, map));
+					continue;
+				}
+				for (; node != HBV::EmptyNode; node &= node - 1)
+					result = combine(std::move(result), Helper::Dispatch(states, prefix | HBV::lowbit_pos(node), map));
+			}
+			return result;
+		};
+		auto join = [&combine](T left, T right)
+		{
+			return combine(std::move(left), std::move(right));
+		};
+		tbb::blocked_range<std::size_t> range(0u, words.size(), Grain);
+		if constexpr(Deterministic)
+			return tbb::parallel_deterministic_reduce(range, identity, body, join);
+		else
+			return tbb::parallel_reduce(range, identity, body, join);
+	}
+
+	template<bool Deterministic = false, typename T, typename M, typename C>
+	T ReduceParallel(States &states, T identity, M&& map, C&& combine)
+	{
+		return ReduceParallel<Deterministic>(FetchFor(states, map), std::move(identity), map, combine);
+	}
+
+	//States::Reorder with a parallel sort, states are permuted concurrently
+	template<typename T, typename F>
+	std::vector<index_t> ReorderParallel(States& states, index_t begin, index_t end, F&& key)
+	{
+		auto order = states.SortByKey<T>(begin, end, key, [](auto first, auto last)
+		{
+			tbb::parallel_sort(first, last);
+		});
+		states.Permute(begin, order, [](auto first, auto last, auto&& f)
+		{
+			tbb::parallel_for_each(first, last, f);
+		});
+		return order;
+	}
+
+	//States::Tick with the removal of killed entities fanned out over the states
+	inline void TickParallel(States& states, index_t growThreshold = 10u)
+	{
+		states.Tick(growThreshold, [](auto first, auto last, auto&& f)
+		{
+			tbb::parallel_for_each(first, last, f);
+		});
+	}
+
+	//States::ResetTracers with the states reset concurrently
+	inline void ResetTracersParallel(States& states)
+	{
+		states.ResetTracers([](auto first, auto last, auto&& f)
+		{
+			tbb::parallel_for_each(first, last, f);
+		});
+	}
+
+	//clone the shared prototype for a whole entity range in one parallel pass
+	template<typename T, Trace... types>
+	void BatchUnshareParallel(EntityState<SharedVec<T>, types...>& state, index_t begin, index_t end)
+	{
+		auto& container = state.Raw();
+		index_t base = container.ReserveSlots(end - begin);
+		tbb::parallel_for(tbb::blocked_range<index_t>(begin, end), [&container, base, begin](const tbb::blocked_range<index_t>& range)
+		{
+			for (index_t i = range.begin(); i != range.end(); ++i)
+				container.UnshareTo(i, base + i - begin);
+		});
+		container.ReleaseSlots(base, end - begin);
+	}
 }
 
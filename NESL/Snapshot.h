@@ -0,0 +1,144 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cassert>
+#include <stdexcept>
+#include "Memory.h"
+
+namespace ESL
+{
+	//large columns start on a page, so they are copied from aligned memory
+	constexpr std::size_t SnapshotAlign = 4096u;
+	//"NESL", bumped with the layout
+	constexpr uint32_t SnapshotMagic = 0x4C53454Eu;
+	constexpr uint32_t SnapshotVersion = 1u;
+
+	class SnapshotWriter
+	{
+		std::ofstream _file;
+		std::size_t _offset = 0u;
+
+	public:
+		SnapshotWriter(const char* path)
+			: _file(path, std::ios::binary | std::ios::trunc) {}
+
+		bool Good() const noexcept
+		{
+			return _file.good();
+		}
+
+		std::size_t Offset() const noexcept
+		{
+			return _offset;
+		}
+
+		void Write(const void* data, std::size_t bytes)
+		{
+			_file.write((const char*)data, bytes);
+			_offset += bytes;
+		}
+
+		template<typename T>
+		void Write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "only bytes are written!");
+			Write(&value, sizeof(T));
+		}
+
+		void WriteString(const std::string& value)
+		{
+			Write((uint32_t)value.size());
+			Write(value.data(), value.size());
+		}
+
+		void Align(std::size_t alignment = SnapshotAlign)
+		{
+			static const char zeros[SnapshotAlign]{};
+			Write(zeros, VirtualMemory::AlignUp(_offset, alignment) - _offset);
+		}
+
+		//rewrite a value written before, the end of the file is kept
+		template<typename T>
+		void Patch(std::size_t offset, const T& value)
+		{
+			_file.seekp(offset);
+			_file.write((const char*)&value, sizeof(T));
+			_file.seekp(_offset);
+		}
+	};
+
+	//a read past the end of the file or content that can't be valid, Load returns false on it
+	struct SnapshotError : std::runtime_error
+	{
+		using std::runtime_error::runtime_error;
+	};
+
+	//reads in place from the mapped file, every read is checked against the end of the file
+	class SnapshotReader
+	{
+		MappedFile _file;
+		std::size_t _offset = 0u;
+
+	public:
+		SnapshotReader(const char* path) noexcept
+			: _file(path) {}
+
+		bool Good() const noexcept
+		{
+			return _file.Data() != nullptr;
+		}
+
+		std::size_t Size() const noexcept
+		{
+			return _file.Size();
+		}
+
+		std::size_t Remaining() const noexcept
+		{
+			return _file.Size() - _offset;
+		}
+
+		//valid as long as the reader
+		const void* Read(std::size_t bytes)
+		{
+			Require(bytes <= Remaining(), "snapshot is truncated");
+			const char* data = _file.Data() + _offset;
+			_offset += bytes;
+			return data;
+		}
+
+		//count values of size bytes, a count read from the file can't overflow the check
+		const void* Read(std::size_t count, std::size_t size)
+		{
+			Require(size == 0u || count <= Remaining() / size, "snapshot is truncated");
+			return Read(count * size);
+		}
+
+		template<typename T>
+		T Read()
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "only bytes are read!");
+			T value;
+			memcpy(&value, Read(sizeof(T)), sizeof(T));
+			return value;
+		}
+
+		std::string ReadString()
+		{
+			uint32_t size = Read<uint32_t>();
+			return std::string((const char*)Read(size), size);
+		}
+
+		void Align(std::size_t alignment = SnapshotAlign)
+		{
+			Read(VirtualMemory::AlignUp(_offset, alignment) - _offset);
+		}
+
+		void Require(bool valid, const char* what) const
+		{
+			if (!valid)
+				throw SnapshotError(what);
+		}
+	};
+}
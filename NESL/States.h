@@ -1,12 +1,22 @@
 #pragma once
-#include <any>
+#include <memory>
+#include <chrono>
 #include <unordered_map>
 #include <functional>
 #include <bitset>
 #include <atomic>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+#include <limits>
+#include <stdexcept>
 #include "GlobalState.h"
 #include "Entity.h"
 #include "EntityState.h"
+#include "DynamicState.h"
 #include "MPL.h"
 
 namespace ESL
@@ -27,6 +37,14 @@ namespace ESL \
 	struct TState<name> { using type = EntityState<container<name>, __VA_ARGS__>; }; \
 }
 
+//zero size component, only the membership bit is kept
+#define ENTITY_TAG(name, ...) \
+namespace ESL \
+{ \
+	template<> \
+	struct TState<name> { using type = EntityState<Placeholder<name>, __VA_ARGS__>; }; \
+}
+
 #define GLOBAL_STATE(name) \
 namespace ESL \
 { \
@@ -34,6 +52,13 @@ namespace ESL \
 	struct TState<name> { using type = GlobalState<name>; }; \
 }
 
+#define COMBINABLE_STATE(name) \
+namespace ESL \
+{ \
+	template<> \
+	struct TState<name> { using type = CombinableState<name>; }; \
+}
+
 	template<typename T>
 	struct IsState : MPL::is_complete<TState<T>> {};
 
@@ -73,6 +98,14 @@ namespace ESL \
 		using Raw = T;
 	};
 
+	template<typename T>
+	struct TStateNonstrict<CombinableState<T>>
+	{
+		using State = CombinableState<T>;
+		using Type = TGlobalState;
+		using Raw = T;
+	};
+
 	template<typename T>
 	using StateNonstrict = typename TStateNonstrict<std::decay_t<T>>::State;
 
@@ -104,29 +137,282 @@ namespace ESL \
 	struct IsEntityState : std::is_same<typename TStateNonstrict<StateNonstrict<T>>::Type, TEntityState> {};
 
 
+	//per entity values for BatchSpawnEntity, the i-th spawned entity takes the i-th value
+	template<typename It>
+	struct Values_t
+	{
+		It first;
+		std::size_t size;
+		using value_type = std::decay_t<decltype(*std::declval<It&>())>;
+	};
+
+	template<typename F>
+	struct GenerateIterator
+	{
+		//mutable lambdas keep their state across calls, the iterator is only read through
+		mutable F f;
+		index_t i;
+
+		//an input iterator, so std algorithms such as copy_n take it
+		using iterator_category = std::input_iterator_tag;
+		using reference = decltype(std::declval<F&>()(index_t{}));
+		using value_type = std::decay_t<reference>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+
+		decltype(auto) operator*() const
+		{
+			return f(i);
+		}
+
+		GenerateIterator& operator++()
+		{
+			++i;
+			return *this;
+		}
+
+		GenerateIterator operator++(int)
+		{
+			GenerateIterator old = *this;
+			++i;
+			return old;
+		}
+
+		bool operator==(const GenerateIterator& other) const
+		{
+			return i == other.i;
+		}
+
+		bool operator!=(const GenerateIterator& other) const
+		{
+			return i != other.i;
+		}
+	};
+
+	//copy from a contiguous container, trivially copyable states are copied at once
+	template<typename C>
+	auto FromRange(const C& c)
+	{
+		return Values_t<decltype(std::data(c))>{ std::data(c), std::size(c) };
+	}
+
+	//move out of a contiguous container, for move only or expensive states
+	template<typename C>
+	auto MoveFrom(C& c)
+	{
+		auto first = std::make_move_iterator(std::data(c));
+		return Values_t<decltype(first)>{ first, std::size(c) };
+	}
+
+	template<typename It>
+	auto FromIterator(It first)
+	{
+		return Values_t<It>{ first, std::numeric_limits<std::size_t>::max() };
+	}
+
+	//f(i) makes the value of the i-th spawned entity
+	template<typename F>
+	auto Generate(F f)
+	{
+		return FromIterator(GenerateIterator<F>{ f, 0u });
+	}
+
+	//wall time of each phase of the last Tick
+	struct TickTimings
+	{
+		std::chrono::steady_clock::duration remove{};
+		std::chrono::steady_clock::duration kill{};
+		std::chrono::steady_clock::duration swap{};
+	};
+
+	//dense ids of state types keyed by their typeid name, which every module agrees on
+	//a plugin reaches the registry of the host through the States it is handed
+	class StateRegistry
+	{
+		std::mutex _lock;
+		std::unordered_map<std::string, index_t> _ids;
+
+	public:
+		index_t Id(const char* name)
+		{
+			std::lock_guard<std::mutex> guard{ _lock };
+			return _ids.emplace(name, index_t(_ids.size())).first->second;
+		}
+	};
+
+	//registry of the worlds this module creates
+	inline StateRegistry& ModuleStateRegistry()
+	{
+		static StateRegistry registry;
+		return registry;
+	}
+
+	//slot of a state type in the worlds of registry, each module caches it for the registry last asked
+	template<typename ST>
+	index_t StateId(StateRegistry& registry)
+	{
+		//registry address and id in one word, a hit never pairs an id with another registry
+		static std::atomic<uint64_t> cache{ 0u };
+		uint64_t key = uint64_t(reinterpret_cast<uintptr_t>(&registry)) << 16;
+		uint64_t cached = cache.load(std::memory_order_acquire);
+		if ((cached & ~uint64_t(0xFFFFu)) == key)
+			return index_t(cached & 0xFFFFu);
+		index_t id = registry.Id(typeid(ST).name());
+		assert(id <= 0xFFFFu);
+		cache.store(key | id, std::memory_order_release);
+		return id;
+	}
+
 	class States
 	{
-		std::unordered_map<std::size_t, std::any> _states;
+		//shared by the worlds of a process and their forks
+		StateRegistry* _registry;
+		//indexed by StateId, empty slots for states this world doesn't have
+		std::vector<std::shared_ptr<void>> _states;
+		//copies the state of a slot into a fork, null if the state can't be copied
+		using Forker = void(*)(States& fork, const void* state);
+		std::vector<Forker> _forkers;
+		//components registered at runtime, by name
+		std::unordered_map<std::string, std::unique_ptr<DynamicState>> _dynamicStates;
 		std::vector<EntityStateBase*> _entityStates;
+		//double buffered states, swapped every tick
+		std::vector<EntityStateBase*> _bufferedStates;
+		//upstream of every entity state, point it to an arena to keep a world contiguous
+		std::pmr::memory_resource* _resource;
 		GlobalState<ESL::Entities>& _entities;
+		TickTimings _tickTimings;
+
+		//returns false if the state already exists
+		template<typename ST, typename... Ts>
+		bool Emplace(Ts&&... args)
+		{
+			index_t id = StateId<ST>(*_registry);
+			if (_states.size() <= id)
+			{
+				_states.resize(id + 1);
+				_forkers.resize(id + 1, nullptr);
+			}
+			if (_states[id] != nullptr)
+				return false;
+			_states[id] = std::make_shared<ST>(std::forward<Ts>(args)...);
+			return true;
+		}
+
+		template<typename ST>
+		ST& TrackEntityState()
+		{
+			auto& state = *static_cast<ST*>(_states[StateId<ST>(*_registry)].get());
+			_entityStates.emplace_back(&state);
+			if constexpr(IsDoubleBuffered<ST>{})
+				_bufferedStates.emplace_back(&state);
+			if constexpr(ST::Forkable)
+				_forkers[StateId<ST>(*_registry)] = [](States& fork, const void* state)
+				{
+					fork.Emplace<ST>(*static_cast<const ST*>(state), fork._resource);
+					fork.TrackEntityState<ST>();
+				};
+			return state;
+		}
 		
 	public:
-		States() : _entities(CreateState<ESL::Entities>()) {}
+		//plugins must use the worlds of the host, or a world made with its registry
+		States(std::pmr::memory_resource* resource = std::pmr::get_default_resource(), StateRegistry& registry = ModuleStateRegistry()) 
+			: _registry(&registry), _resource(resource), _entities(CreateState<ESL::Entities>()) {}
 
-		void Tick(index_t growThreshold = 10u)
+		template<typename ST>
+		index_t Id() const
+		{
+			return StateId<ST>(*_registry);
+		}
+
+		StateRegistry& Registry() const noexcept
+		{
+			return *_registry;
+		}
+
+		States(const States&) = delete;
+		States& operator=(const States&) = delete;
+
+		//a world to branch from this one, for speculative runs that are thrown away
+		//bit_vectors share their blocks and PagedVec states their pages copy on write, other columns are copied
+		//returns null if a state can't be copied, don't fork while systems run and destroy forks before this world
+		std::unique_ptr<States> Fork() const
+		{
+			for (std::size_t id = 0; id < _states.size(); ++id)
+				if (_states[id] != nullptr && _forkers[id] == nullptr)
+					return nullptr;
+			for (auto& pair : _dynamicStates)
+				if (!pair.second->Forkable())
+					return nullptr;
+			std::unique_ptr<States> fork{ new States(*this, _resource) };
+			//Entities is already there, its forker finds the slot taken
+			for (std::size_t id = 0; id < _states.size(); ++id)
+				if (_states[id] != nullptr)
+				{
+					_forkers[id](*fork, _states[id].get());
+					fork->_forkers[id] = _forkers[id];
+				}
+			for (auto& pair : _dynamicStates)
+			{
+				auto& state = fork->_dynamicStates[pair.first];
+				state = std::make_unique<DynamicState>(*pair.second, fork->_resource);
+				fork->_entityStates.emplace_back(state.get());
+			}
+			return fork;
+		}
+
+		//states are independent, forEach may run them concurrently if the world's resource is thread safe
+		template<typename ForEach>
+		void Tick(index_t growThreshold, ForEach&& forEach)
 		{
+			using clock = std::chrono::steady_clock;
 			auto& entities = _entities.Raw();
-			for (auto &e : _entityStates)
+			auto start = clock::now();
+			forEach(_entityStates.begin(), _entityStates.end(), [&entities](EntityStateBase* e)
+			{
 				e->BatchRemove(entities._killed);
+			});
+			auto removed = clock::now();
 			entities.DoKill();
 			if (entities._freeCount <= growThreshold)
 				entities.Grow();
+			auto killed = clock::now();
+			forEach(_bufferedStates.begin(), _bufferedStates.end(), [](EntityStateBase* e)
+			{
+				e->SwapBuffers();
+			});
+			_tickTimings = TickTimings{ removed - start, killed - removed, clock::now() - killed };
 		}
 
-		void ResetTracers()
+		void Tick(index_t growThreshold = 10u)
 		{
-			for (auto &e : _entityStates)
+			Tick(growThreshold, [](auto first, auto last, auto&& f)
+			{
+				std::for_each(first, last, f);
+			});
+		}
+
+		const TickTimings& LastTick() const noexcept
+		{
+			return _tickTimings;
+		}
+
+		//tracer bitsets expire in O(1), what is left per state is releasing journals
+		template<typename ForEach>
+		void ResetTracers(ForEach&& forEach)
+		{
+			forEach(_entityStates.begin(), _entityStates.end(), [](EntityStateBase* e)
+			{
 				e->ResetTracers();
+			});
+		}
+
+		void ResetTracers()
+		{
+			ResetTracers([](auto first, auto last, auto&& f)
+			{
+				std::for_each(first, last, f);
+			});
 		}
 
 		auto& Entities()
@@ -144,30 +430,156 @@ namespace ESL \
 			else
 			{
 				using ST = State<T>;
-				auto it = _states.find(typeid(ST).hash_code());
-				return it != _states.end() ? &std::any_cast<ST&>(it->second) : nullptr;
+				index_t id = StateId<ST>(*_registry);
+				return id < _states.size() ? static_cast<ST*>(_states[id].get()) : nullptr;
 			}
 		}
 
 	public:
 		template<typename T, std::enable_if_t<IsEntityState<State<T>>::value, int> = 0>
-		auto &CreateState() noexcept
+		auto &CreateState()
 		{
 			using ST = State<T>;
-			auto &state = std::any_cast<ST&>(_states.insert({ typeid(ST).hash_code(), std::make_any<ST>() }).first->second);
-			_entityStates.emplace_back(&state);
-			return state;
+			if (!Emplace<ST>(_resource))
+				return *GetState<T>();
+			return TrackEntityState<ST>();
+		}
+
+		//a component known only at runtime, returns the existing state if the name is taken
+		DynamicState& CreateDynamicState(ComponentDesc desc)
+		{
+			auto& state = _dynamicStates[desc.name];
+			if (state == nullptr)
+			{
+				state = std::make_unique<DynamicState>(std::move(desc), _resource);
+				_entityStates.emplace_back(state.get());
+			}
+			return *state;
+		}
+
+		DynamicState* GetDynamicState(const std::string& name) noexcept
+		{
+			auto it = _dynamicStates.find(name);
+			return it != _dynamicStates.end() ? it->second.get() : nullptr;
+		}
+
+		std::pmr::memory_resource* Resource() const noexcept
+		{
+			return _resource;
+		}
+
+		//bytes held by all entity states
+		std::size_t AllocatedBytes() const noexcept
+		{
+			std::size_t bytes = 0u;
+			for (auto &e : _entityStates)
+				bytes += e->AllocatedBytes();
+			return bytes;
+		}
+
+		//memory of every entity state in registration order, walks the bit_vectors but no values
+		//pass the previous report back to sample every frame without allocating
+		void MemoryReport(std::vector<StateMemory>& report) const
+		{
+			report.resize(_entityStates.size());
+			for (std::size_t i = 0; i < _entityStates.size(); ++i)
+				_entityStates[i]->Measure(report[i]);
+		}
+
+		std::vector<StateMemory> MemoryReport() const
+		{
+			std::vector<StateMemory> report;
+			MemoryReport(report);
+			return report;
+		}
+
+		//the entities and every entity state in one file, large columns start on a page
+		//returns false if a state isn't savable or the file can't be written, global states are not saved
+		bool Save(const char* path) const
+		{
+			for (auto& e : _entityStates)
+				if (!e->Savable())
+					return false;
+			SnapshotWriter out(path);
+			out.Write(SnapshotMagic);
+			out.Write(SnapshotVersion);
+			//size of the file, written last
+			out.Write(uint64_t(0u));
+			out.Write(uint32_t(_entityStates.size()));
+			for (auto& e : _entityStates)
+				out.WriteString(e->Name());
+			_entities.Raw().Save(out);
+			for (auto& e : _entityStates)
+				e->Save(out);
+			out.Patch(8u, uint64_t(out.Offset()));
+			return out.Good();
+		}
+
+		//into a fresh world with the same states created, the file is mapped and copied from
+		//returns false and loads nothing if the file doesn't match this world
+		//returns false too if the file is truncated or corrupt, the world is then partially loaded and should be dropped
+		bool Load(const char* path)
+		{
+			SnapshotReader in(path);
+			constexpr std::size_t header = 20u;
+			if (!in.Good() || in.Size() < header || in.Read<uint32_t>() != SnapshotMagic
+				|| in.Read<uint32_t>() != SnapshotVersion || in.Read<uint64_t>() != in.Size())
+				return false;
+			uint32_t count = in.Read<uint32_t>();
+			if (count != _entityStates.size())
+				return false;
+			std::unordered_map<std::string, EntityStateBase*> named;
+			for (auto& e : _entityStates)
+				named.emplace(e->Name(), e);
+			std::vector<EntityStateBase*> order;
+			try
+			{
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					auto it = named.find(in.ReadString());
+					if (it == named.end())
+						return false;
+					order.push_back(it->second);
+				}
+				_entities.Raw().Load(in);
+				for (auto& e : order)
+					e->Load(in);
+			}
+			catch (const SnapshotError&)
+			{
+				return false;
+			}
+			return true;
 		}
 
 		template<typename T, typename... Ts>
-		auto &CreateState(Ts&&... args) noexcept
+		auto &CreateState(Ts&&... args)
 		{
+			//not through GetState, Entities is created before _entities is bound
 			using ST = State<T>;
-			auto &state = std::any_cast<ST&>(_states.insert({ typeid(ST).hash_code(), std::make_any<ST>(args...) }).first->second);
-			return state;
+			bool created = Emplace<ST>(std::forward<Ts>(args)...);
+			if constexpr(std::is_copy_constructible_v<ST>)
+			{
+				if (created)
+					_forkers[StateId<ST>(*_registry)] = [](States& fork, const void* state)
+					{
+						fork.Emplace<ST>(*static_cast<const ST*>(state));
+					};
+			}
+			return *static_cast<ST*>(_states[StateId<ST>(*_registry)].get());
 		}
 
 	private:
+		void CheckInstantiable(index_t prototype) const
+		{
+			for (auto state : _entityStates)
+				if (state->Contain(prototype) && !state->Instantiable())
+					throw std::logic_error("move only states can't be instantiated");
+		}
+
+		//a fork starts from a copy of the entities
+		States(const States& world, std::pmr::memory_resource* resource)
+			: _registry(world._registry), _resource(resource), _entities(CreateState<ESL::Entities>(world._entities.Raw())) {}
 		
 		template<typename T>
 		void BatchSpawnComponent(std::pair<index_t, index_t> es, const T& arg)
@@ -176,6 +588,15 @@ namespace ESL \
 			state->BatchCreate(es.first, es.second, arg);
 		}
 
+		template<typename It>
+		void BatchSpawnComponent(std::pair<index_t, index_t> es, const Values_t<It>& values)
+		{
+			using T = typename Values_t<It>::value_type;
+			assert(values.size >= es.second - es.first);
+			auto state = GetState<T>();
+			state->BatchCreateFrom(es.first, es.second, values.first);
+		}
+
 	public:
 
 		Entity SpawnEntity()
@@ -185,9 +606,11 @@ namespace ESL \
 		}
 
 		//ע:_entityStates,
+		//throws std::logic_error before spawning if a state of the prototype is move only
 		template<typename... Ts>
 		Entity InstantiateEntity(index_t prototype)
 		{
+			CheckInstantiable(prototype);
 			Entity e = SpawnEntity();
 			for (auto &s : _entityStates)
 				if (s.Contain(prototype))
@@ -195,6 +618,7 @@ namespace ESL \
 			return e;
 		}
 
+		//each arg is a value copied to every entity, or a source from FromRange, MoveFrom, FromIterator or Generate
 		template<typename... Ts>
 		std::pair<index_t, index_t> BatchSpawnEntity(index_t n, const Ts&... args)
 		{
@@ -206,6 +630,7 @@ namespace ESL \
 		template<typename... Ts>
 		std::pair<index_t, index_t> BatchInstantiateEntity(index_t n, index_t prototype)
 		{
+			CheckInstantiable(prototype);
 			std::pair<index_t, index_t> es = _entities.Raw().BatchSpawn(n);
 			for (auto &e : _entityStates)
 				if (e.Contain(prototype))
@@ -218,6 +643,59 @@ namespace ESL \
 			return _entities.Raw().Get(n);
 		}
 
+		//entity begin + i takes everything of entity order[i], in every state and tracer
+		//handles of entities in the range are invalidated
+		template<typename ForEach>
+		void Permute(index_t begin, const std::vector<index_t>& order, ForEach&& forEach)
+		{
+			assert(begin + order.size() <= _entities.Raw()._generation.size());
+			_entities.Raw().Permute(begin, order);
+			forEach(_entityStates.begin(), _entityStates.end(), [begin, &order](EntityStateBase* e)
+			{
+				e->Permute(begin, order);
+			});
+		}
+
+		void Permute(index_t begin, const std::vector<index_t>& order)
+		{
+			Permute(begin, order, [](auto first, auto last, auto&& f)
+			{
+				std::for_each(first, last, f);
+			});
+		}
+
+		//sort [begin, end) by key(const T&) for locality, entities without T go last
+		//returns the order, entity begin + i used to be order[i]
+		template<typename T, typename F>
+		std::vector<index_t> Reorder(index_t begin, index_t end, F&& key)
+		{
+			auto order = SortByKey<T>(begin, end, key, [](auto first, auto last)
+			{
+				std::sort(first, last);
+			});
+			Permute(begin, order);
+			return order;
+		}
+
+		template<typename T, typename F, typename S>
+		std::vector<index_t> SortByKey(index_t begin, index_t end, F&& key, S&& sort)
+		{
+			using Key = std::decay_t<decltype(key(std::declval<const T&>()))>;
+			const auto& state = *GetState<T>();
+			//missing first so entities without T sort last whatever the key, any key with operator< works
+			std::vector<std::tuple<bool, Key, index_t>> keys(end - begin);
+			for (index_t e = begin; e < end; ++e)
+			{
+				bool missing = !state.Contain(e);
+				keys[e - begin] = { missing, missing ? Key{} : key(state.Get(e)), e };
+			}
+			sort(keys.begin(), keys.end());
+			std::vector<index_t> order(end - begin);
+			for (index_t i = 0; i < order.size(); ++i)
+				order[i] = std::get<2>(keys[i]);
+			return order;
+		}
+
 
 	};
 }
@@ -32,6 +32,7 @@ namespace ESL
 	{
 		std::size_t size = _flattenNodes.size();
 		lni::vector<TbbGraph::LogicNode*> nodes;
+		nodes.resize(_graph.size(), nullptr);
 		graph._logicNodes.reserve(size + 1);
 		for (long long i = size - 1; i >= 0; i--)
 		{
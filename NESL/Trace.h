@@ -1,5 +1,6 @@
 #pragma once
 #include <type_traits>
+#include <atomic>
 #include "HBV.h"
 
 namespace ESL
@@ -14,7 +15,11 @@ namespace ESL
 		RB     = 0b00110,
 		CRB    = 0b00111,
 		HasNot = 0b01000,
-		Has    = 0b10000
+		Has    = 0b10000,
+		//change stamps for Create and Borrow, filtered per system by a Cursor, never reset
+		Versioned = 0b100000,
+		//keep removed values until the tracers are reset
+		Journal = 0b1000000
 	};
 
 	//example: Tag<ELocation, Create>
@@ -28,7 +33,7 @@ namespace ESL
 #define FHas(T) ESL::Filter_t<T, ESL::Has> = {}
 #define FCreated(T) ESL::Filter_t<T, ESL::Create> = {}
 #define FRemoved(T) ESL::Filter_t<T, ESL::Remove> = {}
-#define FBorrowed(T) ESL::Filter_t<T, Borrow> = {}
+#define FBorrowed(T) ESL::Filter_t<T, ESL::Borrow> = {}
 #define FHasNot(T) ESL::Filter_t<T, ESL::HasNot> = {}
 
 #define Filter(T, W) ESL::Filter_t<T, W> = {}
@@ -39,13 +44,28 @@ namespace ESL
 	template<typename T, Trace type>
 	struct is_filter<Filter_t<T, type>> : std::true_type {};
 
+	//all layers of a bit_vector
+	inline std::size_t BitVectorBytes(const HBV::bit_vector& vec) noexcept
+	{
+		std::size_t bytes = 0u;
+		for (auto layer : vec.bytes())
+			bytes += layer;
+		return bytes;
+	}
+
 	template<Trace type>
 	struct Tracer
 	{
 		static_assert(type < 0b1001 && type > 0, "wrong type!");
-		HBV::bit_vector flag{ 10u };
+		HBV::bit_vector flag;
 		using bit_vector_and2 = decltype(HBV::compose(HBV::and_op, HBV::bit_vector{}, HBV::bit_vector{}));
 
+		Tracer(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+			: flag(10u, (type & Trace::HasNot) != 0, resource) {}
+
+		Tracer(const Tracer& other, std::pmr::memory_resource* resource) noexcept
+			: flag(other.flag, resource) {}
+
 		void Create(HBV::index_t e)
 		{
 			if (flag.size() <= e)
@@ -66,8 +86,23 @@ namespace ESL
 		void Change(HBV::index_t e)
 		{
 			if constexpr(type & Trace::Borrow)
+			{
+				if (flag.size() <= e)
+					flag.grow_to(e + 64 * 64);
 				flag.set(e, true);
+			}
+		}
 
+		//or a whole set into the flag, one layer3 word at a time
+		template<typename V>
+		void BatchChange(HBV::index_t size, const V& vec)
+		{
+			if constexpr(type & Trace::Borrow)
+			{
+				if (flag.size() < size)
+					flag.grow_to(size);
+				flag.merge(vec);
+			}
 		}
 
 		void Remove(HBV::index_t e)
@@ -81,13 +116,32 @@ namespace ESL
 		void BatchCreate(index_t begin, index_t end)
 		{
 			if (flag.size() <= end)
-				flag.grow_to(end);
+			{
+				if constexpr(type & Trace::HasNot)
+					flag.grow_to(end + 64 * 64, true);
+				else
+					flag.grow_to(end);
+			}
 			if constexpr(type & Trace::Create)
 				flag.set_range(begin, end, true);
 			if constexpr(type & Trace::HasNot)
 				flag.set_range(begin, end, false);
 		}
 
+		template<typename Order>
+		void Permute(HBV::index_t begin, const Order& order)
+		{
+			HBV::index_t end = begin + (HBV::index_t)order.size();
+			if (flag.size() <= end)
+			{
+				if constexpr(type & Trace::HasNot)
+					flag.grow_to(end + 64 * 64, true);
+				else
+					flag.grow_to(end + 64 * 64);
+			}
+			HBV::permute(flag, begin, order);
+		}
+
 		void BatchRemove(const bit_vector_and2& remove)
 		{
 			if constexpr(type & Trace::Remove)
@@ -99,14 +153,200 @@ namespace ESL
 		void Reset()
 		{
 			if constexpr(!(type & Trace::HasNot))
-				flag.clear();
+				flag.expire();
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return BitVectorBytes(flag);
+		}
+
+		//after a snapshot is loaded into has, nothing traced yet
+		void Restore(const HBV::bit_vector& has)
+		{
+			if constexpr(type & Trace::HasNot)
+			{
+				if (flag.size() <= has.size())
+					flag.grow_to(has.size() + 64 * 64, true);
+				flag.merge<true>(has);
+			}
+			else if (flag.size() < has.size())
+				flag.grow_to(has.size());
+		}
+	};
+
+	//tracers whose flag only collects entities between resets, an earlier copy can be put back
+	//HasNot follows membership, Versioned and Journal are not plain flags
+	template<typename T>
+	struct IsFlagTracer : std::false_type {};
+
+	template<Trace type>
+	struct IsFlagTracer<Tracer<type>> : std::bool_constant<type < Trace::Versioned && !(type & Trace::HasNot)> {};
+
+	//stamps of versioned tracers and cursors of systems, shared by every world
+	inline std::atomic<uint32_t> ChangeClock{ 1u };
+
+	//a system's view of versioned tracers, filters see changes stamped in (since, last]
+	//each change is seen by exactly one run, changes made while a run is going go to the next one
+	struct Cursor
+	{
+		uint32_t since = 0u;
+		uint32_t last = 0u;
+
+		//call when the system starts a run
+		void Advance() noexcept
+		{
+			since = last;
+			last = ChangeClock.fetch_add(1u, std::memory_order_relaxed);
+		}
+	};
+
+	template<>
+	struct Tracer<Versioned>
+	{
+		HBV::version_vector created;
+		HBV::version_vector borrowed;
+
+		static uint32_t Now() noexcept
+		{
+			return ChangeClock.load(std::memory_order_relaxed);
+		}
+
+		Tracer(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+			: created(resource), borrowed(resource) {}
+
+		Tracer(const Tracer& other, std::pmr::memory_resource* resource) noexcept
+			: created(other.created, resource), borrowed(other.borrowed, resource) {}
+
+		void Create(HBV::index_t e)
+		{
+			created.stamp(e, Now());
+		}
+
+		void Change(HBV::index_t e)
+		{
+			borrowed.stamp(e, Now());
+		}
+
+		template<typename V>
+		void BatchChange(HBV::index_t size, const V& vec)
+		{
+			auto now = Now();
+			borrowed.grow_to(size);
+			HBV::for_each(vec, [this, now](HBV::index_t e)
+			{
+				borrowed.stamp(e, now);
+			});
+		}
+
+		void Remove(HBV::index_t e)
+		{
+			created.clear(e);
+			borrowed.clear(e);
+		}
+
+		void BatchCreate(index_t begin, index_t end)
+		{
+			created.stamp_range(begin, end, Now());
+		}
+
+		template<typename Order>
+		void Permute(HBV::index_t begin, const Order& order)
+		{
+			created.permute(begin, order);
+			borrowed.permute(begin, order);
+		}
+
+		template<typename V>
+		void BatchRemove(const V& remove)
+		{
+			HBV::for_each(remove, [this](HBV::index_t e)
+			{
+				created.clear(e);
+				borrowed.clear(e);
+			});
+		}
+
+		//consumers keep their own cursor, nothing to reset
+		void Reset() {}
+
+		std::size_t Bytes() const noexcept
+		{
+			return created.bytes() + borrowed.bytes();
+		}
+
+		//stamps grow on demand, loaded values count as old
+		void Restore(const HBV::bit_vector& has) {}
+	};
+
+	//ids of the removed values the state keeps in its journal
+	template<>
+	struct Tracer<Journal>
+	{
+		HBV::bit_vector flag;
+
+		Tracer(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+			: flag(10u, false, resource) {}
+
+		Tracer(const Tracer& other, std::pmr::memory_resource* resource) noexcept
+			: flag(other.flag, resource) {}
+
+		void Create(HBV::index_t e)
+		{
+			if (flag.size() <= e)
+				flag.grow_to(e + 64 * 64);
+		}
+
+		void Change(HBV::index_t e) {}
+
+		template<typename V>
+		void BatchChange(HBV::index_t size, const V& vec) {}
+
+		void Remove(HBV::index_t e)
+		{
+			if (flag.size() <= e)
+				flag.grow_to(e + 64 * 64);
+			flag.set(e, true);
+		}
+
+		void BatchCreate(index_t begin, index_t end)
+		{
+			if (flag.size() <= end)
+				flag.grow_to(end);
+		}
+
+		//the journal keeps the ids values were removed at, like its values
+		template<typename Order>
+		void Permute(HBV::index_t begin, const Order& order) {}
+
+		template<typename V>
+		void BatchRemove(const V& remove)
+		{
+			flag.merge(remove);
+		}
+
+		void Reset()
+		{
+			flag.expire();
+		}
+
+		std::size_t Bytes() const noexcept
+		{
+			return BitVectorBytes(flag);
+		}
+
+		void Restore(const HBV::bit_vector& has)
+		{
+			if (flag.size() < has.size())
+				flag.grow_to(has.size());
 		}
 	};
 
 	template<size_t bits, size_t... is>
 	constexpr bool FitTracer()
 	{
-		return bits & ((1 << is) | ...);
+		constexpr size_t mask = ((1 << is) | ...);
+		return (bits & mask) == mask;
 	}
 
 	template<size_t... is, typename Tuple>
@@ -119,7 +359,8 @@ namespace ESL
 	__forceinline decltype(auto) ComposeTracer(const Tuple& tuple, const HBV::bit_vector& has)
 	{
 		constexpr auto covered = (types | ... | 24);
-		constexpr size_t bits = ((1 << types) | ... | 0);
+		//only the bitset tracers can be composed, Versioned and Journal are left out
+		constexpr size_t bits = ((types < Versioned ? size_t(1) << types : 0) | ... | 0);
 		static_assert(type & covered, "no available tracer!");
 		if constexpr(type == Trace::Has)
 		{
@@ -141,28 +382,28 @@ namespace ESL
 				else if TRYFIT(1, 6);
 				else if TRYFIT(2, 5);
 				else if TRYFIT(3, 4);
-				else if TRYFIT(1, 2, 3);
+				else if TRYFIT(3, 5);
+				else if TRYFIT(3, 6);
 				else if TRYFIT(5, 6);
-				else if TRYFIT(4, 6);
-				else return ComposeTracerFlags<4, 5>(tuple);
+				else return ComposeTracerFlags<1, 2, 4>(tuple);
 			}
 			else if constexpr(type == Trace::RB)
 			{
 				if TRYFIT(6);
-				else return ComposeTracerFlags<2, 3>(tuple);
+				else return ComposeTracerFlags<2, 4>(tuple);
 			}
 			else if constexpr(type == Trace::CB)
 			{
 				if TRYFIT(5);
-				else return ComposeTracerFlags<1, 3>(tuple);
+				else return ComposeTracerFlags<1, 4>(tuple);
 			}
 			else if constexpr(type == Trace::CR)
 			{
-				if TRYFIT(4);
+				if TRYFIT(3);
 				else return ComposeTracerFlags<1, 2>(tuple);
 			}
 			else if constexpr(type == Trace::Borrow)
-				return ComposeTracerFlags<3>(tuple);
+				return ComposeTracerFlags<4>(tuple);
 			else if constexpr(type == Trace::Remove)
 				return ComposeTracerFlags<2>(tuple);
 			else if constexpr(type == Trace::Create)